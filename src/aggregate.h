@@ -0,0 +1,204 @@
+/**
+ * @file      aggregate.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Combines the values of several meters of one type into one virtual meter
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <mutex>
+#include <vector>
+#include "definitions.h"
+#include "client.h"
+
+namespace modbus_gateway
+{
+    // A virtual meter whose registers combine the registers of the added meters: summed, unless a rule
+    // says average or maximum. A block is recombined as soon as any meter delivers it, using the latest
+    // values of the other meters, so a slow meter never holds back the others. A meter is stale for a
+    // block when its values are older than the max staleness of the block. Stale meters are left out of
+    // averages and maximums; sums keep their last values, so energy totals never drop.
+    // Read the result through DataAccess, like a Client.
+    template <typename MODBUS_TYPE>
+    class Aggregate
+    {
+    public:
+        using RegisterType = typename MODBUS_TYPE::e_registers;
+        enum Operation
+        {
+            sum,
+            average,
+            maximum
+        };
+        struct Rule
+        {
+            RegisterType _register;
+            Operation _op;
+        };
+
+        Aggregate(ArrayView<Rule> rules) : _device(MODBUS_TYPE::getDeviceDescription()), _transaction(0), _updates(0)
+        {
+            _ops.assign(RegisterType::last, sum);
+            for (auto r = rules.begin(); r < rules.end(); r++)
+                _ops[r->_register] = r->_op;
+        }
+        Aggregate(const Aggregate &) = delete;
+        Aggregate &operator=(const Aggregate &) = delete;
+
+        void add(Client<MODBUS_TYPE> &meter)
+        {
+            Input i;
+            i._meter = &meter;
+            i._generations.assign(_device._dd._bds.size(), 0);
+            i._arrivals.assign(_device._dd._bds.size(), 0);
+            i._seen.assign(_device._dd._bds.size(), false);
+            _inputs.push_back(i);
+        }
+
+        // Recombine the blocks that any meter delivered since the previous call. Returns true when a
+        // block changed.
+        bool update(uint32_t now)
+        {
+            // Locked before the inputs, allValuesAsString reads their arrivals
+            DataAccess<Aggregate<MODBUS_TYPE>> self(*this);
+            const size_t nb = _device._dd._bds.size();
+            _changed.assign(nb, false);
+            bool any = false;
+            for (auto i = _inputs.begin(); i < _inputs.end(); i++)
+            {
+                DataAccess<Client<MODBUS_TYPE>> meter(*i->_meter);
+                bool copy = false;
+                for (size_t b = 0; b < nb; b++)
+                {
+                    uint32_t g = meter.generation(b);
+                    if (g == i->_generations[b])
+                        continue;
+                    i->_generations[b] = g;
+                    i->_arrivals[b] = now;
+                    i->_seen[b] = true;
+                    _changed[b] = true;
+                    copy = true;
+                }
+                if (copy)
+                    meter.copyValues(i->_values);
+                any |= copy;
+            }
+            if (!any)
+                return false;
+
+            uint16_t *image = self.image();
+            for (uint32_t r = 0; r < RegisterType::last; r++)
+            {
+                if (_changed[_device._dd._rr[r]._block_idx])
+                    combine(RegisterType(r), image, now);
+            }
+            for (size_t b = 0; b < nb; b++)
+            {
+                if (_changed[b])
+                    self.setTransaction(b, ++_transaction);
+            }
+            _updates++;
+            return true;
+        }
+
+        // Per meter and block: the age of the values, or - when none arrived yet. Takes the lock of
+        // DataAccess, so don't call it while holding one.
+        String allValuesAsString(uint32_t now) const
+        {
+            std::lock_guard<std::timed_mutex> lock(_Mutex);
+            String r;
+            char buf[200];
+            sprintf(buf, "Aggregate: meters=%u, updates=%u\r\n", unsigned(_inputs.size()), _updates);
+            r += buf;
+            for (size_t m = 0; m < _inputs.size(); m++)
+            {
+                sprintf(buf, "  meter %u:", unsigned(m));
+                r += buf;
+                for (size_t b = 0; b < _device._dd._bds.size(); b++)
+                {
+                    const Input &i = _inputs[m];
+                    if (i._seen[b])
+                        sprintf(buf, " %s=%ums%s", _device._dd._bds[b]._name, now - i._arrivals[b], fresh(i, b, now) ? "" : " stale");
+                    else
+                        sprintf(buf, " %s=-", _device._dd._bds[b]._name);
+                    r += buf;
+                }
+                r += "\r\n";
+            }
+            return r;
+        }
+
+        Device<MODBUS_TYPE> _device;
+
+    private:
+        struct Input
+        {
+            Client<MODBUS_TYPE> *_meter = nullptr;
+            typename Device<MODBUS_TYPE>::Values _values;
+            std::vector<uint32_t> _generations;
+            std::vector<uint32_t> _arrivals;
+            std::vector<bool> _seen;
+        };
+
+        bool fresh(const Input &i, size_t b, uint32_t now) const
+        {
+            uint32_t max = _device._dd._bds[b]._max_staleness;
+            return i._seen[b] && (max == 0 || now - i._arrivals[b] <= max);
+        }
+
+        // Combine one register. Integers are combined exactly, float32 registers as floats.
+        void combine(RegisterType r, uint16_t *image, uint32_t now)
+        {
+            const RegisterReference &rr = _device._dd._rr[r];
+            const BlockDescription &bd = _device._dd._bds[rr._block_idx];
+            const RegisterDescription &rd = bd._rds[rr._register_idx];
+            const size_t b = rr._block_idx;
+            const uint16_t at = rd._offset - bd._offset;
+            const Operation op = _ops[r];
+            int64_t total = 0;
+            int64_t max = INT64_MIN;
+            float ftotal = 0;
+            float fmax = -INFINITY;
+            uint16_t n = 0;
+            for (auto i = _inputs.begin(); i < _inputs.end(); i++)
+            {
+                if (!i->_seen[b] || (op != sum && !fresh(*i, b, now)))
+                    continue;
+                const uint16_t *v = &_device.blockRegisters(i->_values, b)[at];
+                if (rd._dataType == float32)
+                {
+                    // Unscaled, like the registers
+                    float f = rd.value(v) * getScaling(rd._scaling);
+                    ftotal += f;
+                    fmax = std::max(fmax, f);
+                }
+                else
+                {
+                    int64_t x = rd.integer(v);
+                    total += x;
+                    max = std::max(max, x);
+                }
+                n++;
+            }
+            if (n == 0)
+                return;
+            uint16_t *out = &image[_device.registerIndex(r)];
+            if (rd._dataType == float32)
+                rd.setFloat32(out, op == sum ? ftotal : op == average ? ftotal / n : fmax);
+            else
+                rd.setInteger(out, op == sum ? total : op == average ? (total + (total >= 0 ? n / 2 : -n / 2)) / n : max);
+        }
+
+        template <typename T>
+        friend class DataAccess;
+        std::vector<Input> _inputs;
+        std::vector<Operation> _ops;
+        std::vector<bool> _changed;
+        uint32_t _transaction;
+        uint32_t _updates;
+        mutable std::timed_mutex _Mutex;
+    };
+}
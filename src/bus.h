@@ -0,0 +1,99 @@
+/**
+ * @file      bus.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Routes the requests on one RTU bus to the virtual slaves with the addressed server ID
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <array>
+#include "ModbusServer.h"
+
+namespace modbus_gateway
+{
+    // A virtual slave on a Bus
+    class Slave
+    {
+    public:
+        virtual ModbusMessage serve(const ModbusMessage &request) = 0;
+        // Reads only, for other masters than the one on the bus
+        virtual ModbusMessage serveReadOnly(const ModbusMessage &request) = 0;
+
+    protected:
+        ~Slave() = default;
+    };
+
+    // One worker is registered for all server IDs and function codes; it finds the slave in a table
+    // indexed by the server ID. Requests for IDs without a slave are for the other devices on the bus
+    // and get no response.
+    class Bus
+    {
+    public:
+        Bus(ModbusServer &rtu) : _rtu(rtu), _registered(false), _ignored(0)
+        {
+            _slaves.fill(nullptr);
+        }
+        Bus(const Bus &) = delete;
+        Bus &operator=(const Bus &) = delete;
+
+        // Returns false when the ID is not a valid slave ID or already taken
+        bool attach(uint8_t serverId, Slave &slave)
+        {
+            if (serverId == 0 || serverId > 247 || _slaves[serverId] != nullptr)
+                return false;
+            _slaves[serverId] = &slave;
+            if (!_registered)
+            {
+                // MBSworker takes the request by value, the const reference doesn't avoid that copy
+                _rtu.registerWorker(ANY_SERVER, ANY_FUNCTION_CODE, [this](const ModbusMessage &request)
+                                    { return dispatch(request); });
+                _registered = true;
+            }
+            return true;
+        }
+
+        ModbusMessage dispatch(const ModbusMessage &request)
+        {
+            Slave *slave = _slaves[request.getServerID()];
+            if (slave == nullptr)
+            {
+                _ignored++;
+                return NIL_RESPONSE;
+            }
+            return slave->serve(request);
+        }
+
+        // nullptr when no slave has the ID
+        Slave *slave(uint8_t serverId) const
+        {
+            return _slaves[serverId];
+        }
+
+        String allValuesAsString() const
+        {
+            String r = "Bus: slaves=";
+            char buf[200];
+            const char *separator = "";
+            for (size_t id = 0; id < _slaves.size(); id++)
+            {
+                if (_slaves[id] == nullptr)
+                    continue;
+                sprintf(buf, "%s%u", separator, unsigned(id));
+                r += buf;
+                separator = ",";
+            }
+            sprintf(buf, ", requests for other IDs=%u\r\n", _ignored);
+            r += buf;
+            return r;
+        }
+
+    private:
+        ModbusServer &_rtu;
+        std::array<Slave *, 256> _slaves;
+        bool _registered;
+        uint32_t _ignored;
+    };
+}
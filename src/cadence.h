@@ -0,0 +1,153 @@
+/**
+ * @file      cadence.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Timing of the requests of the inverter: when they arrive and how old the served data is
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+namespace modbus_gateway
+{
+    // Learns the interval between requests for the same range, so the next request can be predicted.
+    // arrival() is called by the single task serving the requests, the predictions are read by others.
+    template <uint16_t N>
+    class Cadence
+    {
+    public:
+        Cadence() : _next(0), _version(0)
+        {
+            for (uint16_t i = 0; i < N; i++)
+            {
+                _slots[i]._key.store(0);
+                _slots[i]._last.store(0);
+                _slots[i]._interval.store(0);
+                _slots[i]._count.store(0);
+            }
+        }
+
+        void arrival(uint16_t address, uint16_t words, uint32_t now)
+        {
+            uint32_t key = (uint32_t(address) << 16) | words;
+            Slot *s = nullptr;
+            for (uint16_t i = 0; i < N && s == nullptr; i++)
+            {
+                if (_slots[i]._key.load(std::memory_order_relaxed) == key)
+                    s = &_slots[i];
+            }
+            if (s == nullptr)
+            {
+                s = &_slots[_next++ % N];
+                s->_count.store(0, std::memory_order_relaxed);
+                s->_interval.store(0, std::memory_order_relaxed);
+                s->_key.store(key, std::memory_order_relaxed);
+            }
+            uint32_t count = s->_count.load(std::memory_order_relaxed);
+            if (count > 0)
+            {
+                // Exponential moving average over about 8 intervals
+                uint32_t d = now - s->_last.load(std::memory_order_relaxed);
+                uint32_t interval = s->_interval.load(std::memory_order_relaxed);
+                s->_interval.store(interval == 0 ? d : (interval * 7 + d) / 8, std::memory_order_relaxed);
+            }
+            s->_last.store(now, std::memory_order_relaxed);
+            s->_count.store(count + 1, std::memory_order_relaxed);
+            _version.fetch_add(1, std::memory_order_release);
+        }
+
+        // Changes with every arrival
+        uint32_t version() const { return _version.load(std::memory_order_acquire); }
+
+        // f(address, words, next) for every range with a steady cadence: seen at least 3 times and
+        // last seen no more than 3 intervals ago. next is the first expected arrival after now.
+        template <typename F>
+        void predictions(uint32_t now, F f) const
+        {
+            for (uint16_t i = 0; i < N; i++)
+            {
+                const Slot &s = _slots[i];
+                uint32_t key = s._key.load(std::memory_order_relaxed);
+                uint32_t interval = s._interval.load(std::memory_order_relaxed);
+                uint32_t last = s._last.load(std::memory_order_relaxed);
+                if (s._count.load(std::memory_order_relaxed) < 3 || interval == 0 || now - last > 3 * interval)
+                    continue;
+                uint32_t next = last + interval;
+                while (int32_t(next - now) <= 0)
+                    next += interval;
+                f(key >> 16, key & 0xffff, next);
+            }
+        }
+
+        String allValuesAsString(uint32_t now) const
+        {
+            String result;
+            char buf[100];
+            for (uint16_t i = 0; i < N; i++)
+            {
+                const Slot &s = _slots[i];
+                uint32_t key = s._key.load(std::memory_order_relaxed);
+                if (key == 0)
+                    continue;
+                sprintf(buf, "  start=%u length=%u requests=%u interval=%ums last=%ums ago\r\n", key >> 16, key & 0xffff,
+                        s._count.load(std::memory_order_relaxed), s._interval.load(std::memory_order_relaxed), now - s._last.load(std::memory_order_relaxed));
+                result += buf;
+            }
+            return result;
+        }
+
+    private:
+        struct Slot
+        {
+            std::atomic<uint32_t> _key;
+            std::atomic<uint32_t> _last;
+            std::atomic<uint32_t> _interval;
+            std::atomic<uint32_t> _count;
+        };
+        Slot _slots[N];
+        uint16_t _next;
+        std::atomic<uint32_t> _version;
+    };
+
+    // Counts how old the values were when they were served
+    class AgeHistogram
+    {
+    public:
+        AgeHistogram()
+        {
+            for (auto &c : _counts)
+                c.store(0);
+        }
+
+        void add(uint32_t age)
+        {
+            uint16_t i = 0;
+            while (i < _buckets && age >= _limits[i])
+                i++;
+            _counts[i].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        String allValuesAsString() const
+        {
+            String result = "Data age when served:\r\n";
+            char buf[100];
+            for (uint16_t i = 0; i <= _buckets; i++)
+            {
+                if (i < _buckets)
+                    sprintf(buf, "  < %5ums: %u\r\n", _limits[i], _counts[i].load(std::memory_order_relaxed));
+                else
+                    sprintf(buf, "  >=%5ums: %u\r\n", _limits[i - 1], _counts[i].load(std::memory_order_relaxed));
+                result += buf;
+            }
+            return result;
+        }
+
+    private:
+        static constexpr uint16_t _buckets = 8;
+        static constexpr uint32_t _limits[_buckets] = {25, 50, 100, 200, 300, 500, 1000, 2000};
+        std::atomic<uint32_t> _counts[_buckets + 1];
+    };
+}
@@ -0,0 +1,63 @@
+/**
+ * @file      chunked_response.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      HTTP response sent in chunks from a small fixed buffer
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <WebServer.h>
+
+namespace modbus_gateway
+{
+    // Streams a response with chunked transfer encoding, so the full text never has to be in memory.
+    // Text is collected in the buffer and sent when the buffer is full or the response ends.
+    class ChunkedResponse
+    {
+    public:
+        ChunkedResponse(WebServer &server, int code, const char *type) : _server(server), _length(0)
+        {
+            _server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+            _server.send(code, type, "");
+        }
+        ~ChunkedResponse()
+        {
+            flush();
+            // An empty chunk ends the response
+            _server.sendContent("");
+        }
+        ChunkedResponse(const ChunkedResponse &) = delete;
+        ChunkedResponse &operator=(const ChunkedResponse &) = delete;
+
+        void write(const char *s)
+        {
+            write(s, strlen(s));
+        }
+        void write(const char *s, size_t length)
+        {
+            if (_length + length > sizeof(_buffer))
+                flush();
+            if (length > sizeof(_buffer))
+            {
+                _server.sendContent(s, length);
+                return;
+            }
+            memcpy(_buffer + _length, s, length);
+            _length += length;
+        }
+        void flush()
+        {
+            if (_length > 0)
+                _server.sendContent(_buffer, _length);
+            _length = 0;
+        }
+
+    private:
+        WebServer &_server;
+        char _buffer[1024];
+        size_t _length;
+    };
+}
@@ -9,29 +9,105 @@
 #pragma once
 
 #include "mutex"
+#include <atomic>
+#include <functional>
 #include "definitions.h"
+#include "token_pool.h"
+#include "read_plan.h"
+#include "poll_scheduler.h"
 #include "ModbusClientTCP.h"
 
+// Requests outstanding at once over all clients of a device type, so over all meters and connections,
+// can be set as build flag. Every connection queues at most Client::queue_limit requests.
+#ifndef CLIENT_REQUESTS
+#define CLIENT_REQUESTS 32
+#endif
+
 namespace modbus_gateway
 {
+    // A request passed on to the meter for a proxy, see Client::forward. _token is the token of the
+    // request that answers it. Whoever claims that token stores the response, or the error, and sets
+    // _state last: the eModbus task when the answer arrives, the request pool when it reclaims the token,
+    // or the proxy when it gives up on the request. The others leave it alone.
+    struct Forwarded
+    {
+        enum State : uint8_t
+        {
+            idle,
+            pending,
+            done,
+            failed
+        };
+        std::atomic<uint8_t> _state{idle};
+        std::atomic<uint32_t> _token{0};
+        uint8_t _response[256];
+        uint16_t _length = 0;
+        Error _error = SUCCESS;
+
+        // True for only one caller per token
+        bool claim(uint32_t token)
+        {
+            return token != 0 && _token.compare_exchange_strong(token, 0, std::memory_order_acq_rel);
+        }
+    };
+
+    // Reads from a meter over one or more TCP connections. eModbus sends the requests of a connection one
+    // at a time, so a slow response delays everything queued behind it; with more connections (see
+    // addConnection) every request goes to the connection where it is expected to be answered first:
+    // the fewest queued requests, weighted by the round trip time of that connection.
     template <class MODBUS_TYPE>
     class Client
     {
     public:
         using RegisterType = typename MODBUS_TYPE::e_registers;
+        static constexpr uint16_t max_connections = 4;
+        // Every connection answers a request within request_timeout ms once it is sent, and queues at most
+        // queue_limit requests
+        static constexpr uint32_t request_timeout = 2000;
+        static constexpr uint16_t queue_limit = 10;
+        // Size of the request pool shared by all clients of MODBUS_TYPE
+        static constexpr uint16_t max_requests = CLIENT_REQUESTS;
 
         Client(ModbusClientTCP &tcp, const IPAddress &remote, uint16_t tcp_port, uint16_t tcp_server_id)
-            : _device(MODBUS_TYPE::getDeviceDescription()), _tcp(tcp), _remote(remote), _tcp_port(tcp_port), _transaction(0), _tcp_server_id(tcp_server_id)
+            : _device(MODBUS_TYPE::getDeviceDescription()), _transaction(0), _nbr_connections(0), _remote(remote), _tcp_port(tcp_port), _tcp_server_id(tcp_server_id)
+        {
+            addConnection(tcp);
+            _arrivals.assign(_device.endAddress(), 0);
+            _ttls.assign(_device.endAddress(), 0);
+            _seen.assign(_device.endAddress(), false);
+            for (auto i = _device._dd._bds.begin(); i < _device._dd._bds.end(); i++)
+                std::fill(_ttls.begin() + i->_offset, _ttls.begin() + i->_offset + i->_number_reg, i->_ttl);
+        }
+
+        // Another connection to the same meter, created with a queue limit of queue_limit. Returns false when
+        // there are max_connections already.
+        bool addConnection(ModbusClientTCP &tcp)
         {
-            _tcp.onDataHandler(&Client::handleData);
-            _tcp.onErrorHandler(&Client::handleError);
+            if (_nbr_connections == max_connections)
+                return false;
+            tcp.onDataHandler(&Client::handleData);
+            tcp.onErrorHandler(&Client::handleError);
+            _connections[_nbr_connections++]._tcp = &tcp;
+            return true;
         }
 
         void connect()
         {
-            _tcp.setTimeout(2000, 200);
-            _tcp.begin();
-            _tcp.setTarget(_remote, _tcp_port);
+            for (auto c = _connections; c < _connections + _nbr_connections; c++)
+            {
+                c->_tcp->setTimeout(request_timeout, 200);
+                c->_tcp->begin();
+                c->_tcp->setTarget(_remote, _tcp_port);
+            }
+        }
+
+        // Requests queued on all connections
+        uint32_t pendingRequests()
+        {
+            uint32_t n = 0;
+            for (auto c = _connections; c < _connections + _nbr_connections; c++)
+                n += c->_tcp->pendingRequests();
+            return n;
         }
 
         bool readFromMeter(RegisterType begin, RegisterType end)
@@ -47,28 +123,66 @@ namespace modbus_gateway
         {
             bool result = false;
             if (b._blockNbr == e._blockNbr && b._offset <= e._offset)
-            {
-                static_assert(sizeof(T *) == sizeof(uint32_t));
+                result = readRange(b._offset, e._offset - b._offset + e._number);
+            return result;
+        }
 
-                uint16_t start_reg = b._offset;
-                uint16_t nbr_reg = e._offset - b._offset + e._number;
-                T *t = new T{this, b._blockNbr, start_reg, nbr_reg, _transaction++};
+        // Request a range of registers. The response is stored by address, so the range may span blocks.
+        bool readRange(uint16_t start_reg, uint16_t nbr_reg)
+        {
+            return request(T{this, start_reg, nbr_reg, _transaction.fetch_add(1, std::memory_order_relaxed), uint32_t(millis())});
+        }
 
-                Error err = _tcp.addRequest(reinterpret_cast<uint32_t>(t), _tcp_server_id, READ_HOLD_REGISTER, start_reg, nbr_reg);
-                // Serial.printf("readBlockFromMeter Token=%08X\r\n", t);
-                if (err != SUCCESS)
-                {
-                    char buffer[200];
-                    ModbusError e(err);
-                    sprintf(buffer, "Error creating request: %02X - %s, offset=%i, nbr_reg=%i, %i", (int)e, (const char *)e, start_reg, nbr_reg, _tcp.pendingRequests());
-                    Serial.printf("%s\r\n", buffer);
-                    _log.addString(buffer);
-                }
-                else
-                {
-                    result = true;
-                }
+        // Pass a read request on to the meter for a proxy. The response goes to f, which must stay valid
+        // until its state is no longer pending. A response to FC03 within the device is stored as well.
+        bool forward(Forwarded &f, uint8_t fc, uint16_t start_reg, uint16_t nbr_reg)
+        {
+            f._state.store(Forwarded::pending, std::memory_order_relaxed);
+            if (request(T{this, start_reg, nbr_reg, _transaction.fetch_add(1, std::memory_order_relaxed), uint32_t(millis()), fc, &f}))
+                return true;
+            f._token.store(0, std::memory_order_relaxed);
+            f._state.store(Forwarded::idle, std::memory_order_relaxed);
+            return false;
+        }
+
+        // Copy a range as big endian bytes, when every register belongs to a block and arrived within the
+        // ttl of its block
+        bool cached(uint16_t start_reg, uint16_t nbr_reg, uint32_t now, uint8_t *bytes)
+        {
+            DataAccess<Client<MODBUS_TYPE>> dataaccess(*this);
+            if (uint32_t(start_reg) + nbr_reg > _arrivals.size())
+                return false;
+            for (uint32_t a = start_reg; a < uint32_t(start_reg) + nbr_reg; a++)
+            {
+                if (!_seen[a] || now - _arrivals[a] >= _ttls[a])
+                    return false;
             }
+            dataaccess.readRegisters(start_reg, nbr_reg, bytes);
+            return true;
+        }
+
+        // The requests that read the given registers of the named blocks, see planReads
+        ReadPlan plan(const std::vector<RegisterType> &registers, std::initializer_list<const char *> blocks, uint16_t gap) const
+        {
+            return planReads(_device._dd, registers, blocks, gap);
+        }
+        // Add a job for every polled block, reading the given registers of the block
+        void schedule(PollScheduler &scheduler, const std::vector<RegisterType> &registers, uint16_t gap, uint32_t now) const
+        {
+            for (auto i = _device._dd._bds.begin(); i < _device._dd._bds.end(); i++)
+            {
+                if (i->_period == 0)
+                    continue;
+                ReadPlan p = plan(registers, {i->_name}, gap);
+                if (!p.empty())
+                    scheduler.add(i->_name, p, i->_period, i->_priority, i->_max_staleness, now, i->_min_period);
+            }
+        }
+        bool read(const ReadPlan &plan)
+        {
+            bool result = true;
+            for (auto i = plan.begin(); i < plan.end(); i++)
+                result &= readRange(i->_start, i->_words);
             return result;
         }
 
@@ -83,84 +197,249 @@ namespace modbus_gateway
             return result;
         }
 
+        // Average time from sending a request to storing the response, in ms
+        uint32_t roundTrip() const
+        {
+            return _round_trip.load(std::memory_order_relaxed);
+        }
+
+        // Formats the log, without locking the device
+        String logAsString() const
+        {
+            return _log.allValuesAsString();
+        }
+
+        static String requestPoolAsString()
+        {
+            return _contexts.allValuesAsString();
+        }
+
+        // Requests sent and error responses, timeouts included, on all connections since the start
+        uint32_t requests() const
+        {
+            uint32_t n = 0;
+            for (auto c = _connections; c < _connections + _nbr_connections; c++)
+                n += c->_requests.load(std::memory_order_relaxed);
+            return n;
+        }
+        uint32_t errors() const
+        {
+            uint32_t n = 0;
+            for (auto c = _connections; c < _connections + _nbr_connections; c++)
+                n += c->_errors.load(std::memory_order_relaxed);
+            return n;
+        }
+
+        // Per connection: queued requests, requests sent, errors and round trip time
+        String connectionsAsString()
+        {
+            String r;
+            char buf[200];
+            for (auto c = _connections; c < _connections + _nbr_connections; c++)
+            {
+                sprintf(buf, "Connection %u: pending=%u, requests=%u, errors=%u, round trip=%ums\r\n", unsigned(c - _connections),
+                        unsigned(c->_tcp->pendingRequests()), c->_requests.load(std::memory_order_relaxed), c->_errors.load(std::memory_order_relaxed), c->_round_trip.load(std::memory_order_relaxed));
+                r += buf;
+            }
+            return r;
+        }
+
         template <typename T>
         friend class DataAccess;
 
-        bool _dataRead = false;
+        // Called in the eModbus task after a response is stored, e.g. to wake the task that uses the data
+        void onData(std::function<void()> handler)
+        {
+            _on_data = handler;
+        }
+
         Device<MODBUS_TYPE> _device;
 
+        // Outstanding requests are shared by all clients of this type as the eModbus handlers are static.
+        // A request without a callback after this many ms is considered dropped: it may have waited for
+        // all requests queued before it to time out.
+        static constexpr uint32_t _max_request_age = request_timeout * (queue_limit + 1);
+
     private:
         struct T
         {
             Client *_this;
-            uint32_t _blockindex;
-            uint32_t _start_reg;
-            uint32_t _nbr_reg;
+            uint16_t _start_reg;
+            uint16_t _nbr_reg;
             uint32_t _transaction;
+            uint32_t _issued;
+            uint8_t _fc = READ_HOLD_REGISTER;
+            Forwarded *_forward = nullptr;
+            uint8_t _connection = 0;
+        };
+
+        struct Connection
+        {
+            ModbusClientTCP *_tcp = nullptr;
+            std::atomic<uint32_t> _requests{0};
+            std::atomic<uint32_t> _errors{0};
+            std::atomic<uint32_t> _round_trip{0};
         };
 
+        // The connection expected to answer first. A connection without a measured round trip yet counts
+        // as the average of the client.
+        Connection *choose()
+        {
+            Connection *best = _connections;
+            uint64_t best_wait = UINT64_MAX;
+            for (auto c = _connections; c < _connections + _nbr_connections; c++)
+            {
+                uint32_t rt = c->_round_trip.load(std::memory_order_relaxed);
+                if (rt == 0)
+                    rt = std::max<uint32_t>(roundTrip(), 1);
+                uint64_t wait = uint64_t(c->_tcp->pendingRequests() + 1) * rt;
+                if (wait < best_wait)
+                {
+                    best = c;
+                    best_wait = wait;
+                }
+            }
+            return best;
+        }
+
+        bool request(T t)
+        {
+            Connection *c = choose();
+            t._connection = c - _connections;
+            uint32_t token = _contexts.acquire(t, t._issued, _max_request_age, reclaimed);
+            if (token == 0)
+            {
+                Serial.printf("Request pool exhausted, offset=%i, nbr_reg=%i, %i\r\n", t._start_reg, t._nbr_reg, pendingRequests());
+                _log.add(client_pool_exhausted, t._start_reg, t._nbr_reg, pendingRequests());
+                return false;
+            }
+            // Before the request is queued, as the answer may arrive at once
+            if (t._forward != nullptr)
+                t._forward->_token.store(token, std::memory_order_release);
+
+            Error err = c->_tcp->addRequest(token, _tcp_server_id, FunctionCode(t._fc), t._start_reg, t._nbr_reg);
+            if (err != SUCCESS)
+            {
+                T released{};
+                _contexts.release(token, released);
+                ModbusError e(err);
+                Serial.printf("Error creating request: %02X - %s, offset=%i, nbr_reg=%i, %i\r\n", (int)e, (const char *)e, t._start_reg, t._nbr_reg, pendingRequests());
+                _log.add(client_request_error, (int)e, t._start_reg, t._nbr_reg, pendingRequests());
+                return false;
+            }
+            c->_requests.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+
+        // Moving average of the round trip times, in ms
+        static void measured(std::atomic<uint32_t> &average, uint32_t d)
+        {
+            uint32_t rt = average.load(std::memory_order_relaxed);
+            average.store(rt == 0 ? d : (rt * 7 + d) / 8, std::memory_order_relaxed);
+        }
+
+        // A request that got neither a response nor an error, see TokenPool
+        static void reclaimed(const T &t, uint32_t token)
+        {
+            if (t._forward != nullptr && t._forward->claim(token))
+            {
+                t._forward->_error = GATEWAY_TARGET_NO_RESP;
+                t._forward->_state.store(Forwarded::failed, std::memory_order_release);
+            }
+            t._this->_connections[t._connection]._errors.fetch_add(1, std::memory_order_relaxed);
+        }
+
         // Define an onError handler function to receive error responses
         // Arguments are the error code returned and a user-supplied token to identify the causing request
         static void handleError(Error error, uint32_t token)
         {
             // ModbusError wraps the error code and provides a readable error message for it
             ModbusError me(error);
-            T *t = reinterpret_cast<T *>(token);
-            char buffer[200];
-            sprintf(buffer, "Error response: %02X - %s - %s - %i - %i", (int)me, (const char *)me, t->_this->_device._dd._bds[t->_blockindex]._name.c_str(), t->_transaction, t->_this->_tcp.pendingRequests());
-            Serial.printf("%s\r\n", buffer);
-            t->_this->_log.addString(buffer);
-            delete t;
+            T c{};
+            if (!_contexts.release(token, c))
+            {
+                Serial.printf("Error response: %02X - %s for stale token %08X\r\n", (int)me, (const char *)me, token);
+                return;
+            }
+            T *t = &c;
+            if (t->_forward != nullptr && t->_forward->claim(token))
+            {
+                t->_forward->_error = error;
+                t->_forward->_state.store(Forwarded::failed, std::memory_order_release);
+            }
+            // A connection that times out is chosen less often
+            Connection &connection = t->_this->_connections[t->_connection];
+            connection._errors.fetch_add(1, std::memory_order_relaxed);
+            if (error == TIMEOUT)
+                measured(connection._round_trip, millis() - t->_issued);
+            uint32_t pending = t->_this->pendingRequests();
+            Serial.printf("Error response: %02X - %s - offset=%i, nbr_reg=%i - %i - %i\r\n", (int)me, (const char *)me, t->_start_reg, t->_nbr_reg, t->_transaction, pending);
+            t->_this->_log.add(client_error_response, (int)me, t->_start_reg, t->_nbr_reg, t->_transaction, pending);
         }
 
-        static void handleData(ModbusMessage response, uint32_t token)
+        // eModbus hands the response over through a std::function that takes it by value, so it is
+        // copied once anyway; the const reference only saves moving that copy into the parameter.
+        static void handleData(const ModbusMessage &response, uint32_t token)
         {
-            if (token == 0)
+            T c{};
+            if (!_contexts.release(token, c))
             {
-                Serial.printf("handleData received null ptr\r\n");
+                Serial.printf("handleData received stale token %08X\r\n", token);
                 return;
             }
-            T *t = reinterpret_cast<T *>(token);
+            T *t = &c;
             // Serial.printf("handleData: serverID=%d, FC=%d, Token=%08X\r\n", response.getServerID(), response.getFunctionCode(), token);
-
-            DataAccess<Client<MODBUS_TYPE>> dataaccess(*t->_this);
-            if (t->_blockindex >= 0)
+            if (t->_forward != nullptr)
             {
-                // Serial.printf("Response: serverID=%d, FC=%d, Token=%08X, length=%d, values=%i\r\n", response.getServerID(), response.getFunctionCode(), token, (response.size()-3), (values._values.size()*2) );
-                if ((t->_nbr_reg * 2) == (response.size() - 3))
+                if (t->_forward->claim(token))
                 {
-                    auto i = response.begin();
-                    i += 3;
-                    int index = 0 + (t->_start_reg - t->_this->_device._dd._bds[t->_blockindex]._offset);
-
-                    while (i < response.end())
-                    {
-                        Value v;
-                        v.b2 = *i++;
-                        v.b1 = *i++;
-                        dataaccess.setRegisterValue(t->_blockindex, index++, v.w);
-                    }
-                    t->_this->_dataRead = true;
-                    dataaccess.setTransaction(t->_blockindex, t->_transaction);
+                    t->_forward->_length = std::min<size_t>(response.size(), sizeof(t->_forward->_response));
+                    memcpy(t->_forward->_response, response.data(), t->_forward->_length);
+                    t->_forward->_state.store(Forwarded::done, std::memory_order_release);
                 }
-                else
+                if (t->_fc != READ_HOLD_REGISTER || !t->_this->_device.containsRange(t->_start_reg, t->_nbr_reg))
+                    return;
+            }
+
+            DataAccess<Client<MODBUS_TYPE>> dataaccess(*t->_this);
+            // Serial.printf("Response: serverID=%d, FC=%d, Token=%08X, length=%d\r\n", response.getServerID(), response.getFunctionCode(), token, (response.size()-3));
+            if ((t->_nbr_reg * 2) == (response.size() - 3))
+            {
+                dataaccess.writeRegisters(t->_start_reg, t->_nbr_reg, response.data() + 3);
+                dataaccess.setTransaction(t->_start_reg, t->_nbr_reg, t->_transaction);
+                uint32_t now = millis();
+                uint32_t end = std::min<uint32_t>(t->_start_reg + t->_nbr_reg, t->_this->_arrivals.size());
+                for (uint32_t a = t->_start_reg; a < end; a++)
                 {
-                    char buffer[200];
-                    sprintf(buffer, "Expected bytes: %i, received bytes: %i", t->_nbr_reg * 2, response.size() - 3);
-                    Serial.printf("%s\r\n", buffer);
-                    t->_this->_log.addString(buffer);
+                    t->_this->_arrivals[a] = now;
+                    t->_this->_seen[a] = true;
                 }
+                uint32_t d = now - t->_issued;
+                measured(t->_this->_round_trip, d);
+                measured(t->_this->_connections[t->_connection]._round_trip, d);
+                if (t->_this->_on_data)
+                    t->_this->_on_data();
             }
             else
             {
-                Serial.printf("ERROR: Block for transaction %i not found\r\n", t->_transaction);
+                Serial.printf("Expected bytes: %i, received bytes: %i\r\n", t->_nbr_reg * 2, response.size() - 3);
+                t->_this->_log.add(client_size_mismatch, t->_nbr_reg * 2, response.size() - 3);
             }
-            delete t;
         }
 
+        static inline TokenPool<T, max_requests> _contexts;
+        // When each register arrived, for cached(), indexed by address
+        std::vector<uint32_t> _arrivals;
+        std::vector<uint32_t> _ttls;
+        std::vector<bool> _seen;
+
         modbus_gateway::Log _log;
-        uint32_t _transaction;
-        ModbusClientTCP &_tcp;
+        // Requests are made by the poll task and, for a proxy, by the TCP task
+        std::atomic<uint32_t> _transaction;
+        std::atomic<uint32_t> _round_trip{0};
+        std::function<void()> _on_data;
+        Connection _connections[max_connections];
+        uint16_t _nbr_connections;
         IPAddress _remote;
         uint16_t _tcp_port;
         uint16_t _tcp_server_id;
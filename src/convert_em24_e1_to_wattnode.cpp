@@ -10,70 +10,218 @@
 #include "Arduino.h"
 #include "convert_em24_e1_to_wattnode.h"
 
+modbus_gateway::ConvertEM24_E1ToWattNode::ConvertEM24_E1ToWattNode(modbus_gateway::Aggregate<EM24_E1> &meter, modbus_gateway::Server<WattNode> &wattnode)
+    : _meter(meter), _wattnode(wattnode), _runs(0), _recomputed(0), _skipped(0), _total_recomputed(0), _total_skipped(0), _integer_steps(0)
+{
+    // The mapping from EM24 to WattNode registers
+    static constexpr Rule rules[] = {
+        // Block 1000
+        {WattNode::energy_active, sum, EM24_E1::import_energy_active, EM24_E1::export_energy_active}, // total active energy
+        {WattNode::import_energy_active, copy, EM24_E1::import_energy_active, EM24_E1::last}, // imported active energy
+        {WattNode::energy_active_nr, sum, EM24_E1::import_energy_active, EM24_E1::export_energy_active}, // total active energy non-reset
+        {WattNode::import_energy_active_nr, copy, EM24_E1::import_energy_active, EM24_E1::last}, // imported active energy non-reset
+        {WattNode::power_active, copy, EM24_E1::power_active, EM24_E1::last}, // total power
+        {WattNode::l1_power_active, copy, EM24_E1::l1_power_active, EM24_E1::last},
+        {WattNode::l2_power_active, copy, EM24_E1::l2_power_active, EM24_E1::last},
+        {WattNode::l3_power_active, copy, EM24_E1::l3_power_active, EM24_E1::last},
+        {WattNode::voltage_ln, copy, EM24_E1::voltage_ln, EM24_E1::last}, // l-n voltage
+        {WattNode::l1n_voltage, copy, EM24_E1::l1_voltage, EM24_E1::last}, // l1-n voltage
+        {WattNode::l2n_voltage, copy, EM24_E1::l2_voltage, EM24_E1::last}, // l2-n voltage
+        {WattNode::l3n_voltage, copy, EM24_E1::l3_voltage, EM24_E1::last}, // l3-n voltage
+        {WattNode::voltage_ll, copy, EM24_E1::voltage_ll, EM24_E1::last}, // l-l voltage
+        {WattNode::l12_voltage, copy, EM24_E1::l12_voltage, EM24_E1::last}, // l1-l2 voltage
+        {WattNode::l23_voltage, copy, EM24_E1::l23_voltage, EM24_E1::last}, // l2-l3 voltage
+        {WattNode::l31_voltage, copy, EM24_E1::l31_voltage, EM24_E1::last}, // l3-l1 voltage
+        {WattNode::frequency, copy, EM24_E1::frequency, EM24_E1::last}, // line frequency
+        // Block 1100
+        {WattNode::l1_energy_active, sum_third, EM24_E1::l1_import_energy_active, EM24_E1::export_energy_active}, // total active energy l1
+        {WattNode::l2_energy_active, sum_third, EM24_E1::l2_import_energy_active, EM24_E1::export_energy_active}, // total active energy l2
+        {WattNode::l3_energy_active, sum_third, EM24_E1::l3_import_energy_active, EM24_E1::export_energy_active}, // total active energy l3
+        {WattNode::l1_import_energy_active, copy, EM24_E1::l1_import_energy_active, EM24_E1::last}, // imported active energy l1
+        {WattNode::l2_import_energy_active, copy, EM24_E1::l2_import_energy_active, EM24_E1::last}, // imported active energy l2
+        {WattNode::l3_import_energy_active, copy, EM24_E1::l3_import_energy_active, EM24_E1::last}, // imported active energy l3
+        {WattNode::export_energy_active, copy, EM24_E1::export_energy_active, EM24_E1::last}, // total exported active energy
+        {WattNode::export_energy_active_nr, copy, EM24_E1::export_energy_active, EM24_E1::last}, // total exported active energy non-reset
+        {WattNode::l1_export_energy_active, third, EM24_E1::export_energy_active, EM24_E1::last}, // exported energy l1
+        {WattNode::l2_export_energy_active, third, EM24_E1::export_energy_active, EM24_E1::last}, // exported energy l2
+        {WattNode::l3_export_energy_active, third, EM24_E1::export_energy_active, EM24_E1::last}, // exported energy l3
+        {WattNode::energy_reactive, sum, EM24_E1::import_energy_reactive, EM24_E1::export_energy_reactive}, // total reactive energy
+        //{WattNode::l1_energy_reactive, copy, EM24_E1::l1_energy_reactive, EM24_E1::last}, // reactive energy l1
+        //{WattNode::l2_energy_reactive, copy, EM24_E1::l2_energy_reactive, EM24_E1::last}, // reactive energy l2
+        //{WattNode::l3_energy_reactive, copy, EM24_E1::l3_energy_reactive, EM24_E1::last}, // reactive energy l3
+        //{WattNode::energy_apparent, copy, EM24_E1::energy_apparent, EM24_E1::last}, // total apparent energy
+        //{WattNode::l1_energy_apparent, copy, EM24_E1::l1_energy_apparent, EM24_E1::last}, // apparent energy l1
+        //{WattNode::l2_energy_apparent, copy, EM24_E1::l2_energy_apparent, EM24_E1::last}, // apparent energy l2
+        //{WattNode::l3_energy_apparent, copy, EM24_E1::l3_energy_apparent, EM24_E1::last}, // apparent energy l3
+        {WattNode::power_factor, copy, EM24_E1::total_pf, EM24_E1::last}, // power factor
+        {WattNode::l1_power_factor, copy, EM24_E1::l1_power_factor, EM24_E1::last}, // power factor l1
+        {WattNode::l2_power_factor, copy, EM24_E1::l2_power_factor, EM24_E1::last}, // power factor l2
+        {WattNode::l3_power_factor, copy, EM24_E1::l3_power_factor, EM24_E1::last}, // power factor l3
+        {WattNode::power_reactive, copy, EM24_E1::power_reactive, EM24_E1::last}, // total reactive power
+        {WattNode::l1_power_reactive, copy, EM24_E1::l1_power_reactive, EM24_E1::last}, // reactive power l1
+        {WattNode::l2_power_reactive, copy, EM24_E1::l2_power_reactive, EM24_E1::last}, // reactive power l2
+        {WattNode::l3_power_reactive, copy, EM24_E1::l3_power_reactive, EM24_E1::last}, // reactive power l3
+        {WattNode::power_apparent, copy, EM24_E1::power_apparent, EM24_E1::last}, // total apparent power
+        {WattNode::l1_power_apparent, copy, EM24_E1::l1_power_apparent, EM24_E1::last}, // apparent power l1
+        {WattNode::l2_power_apparent, copy, EM24_E1::l2_power_apparent, EM24_E1::last}, // apparent power l2
+        {WattNode::l3_power_apparent, copy, EM24_E1::l3_power_apparent, EM24_E1::last}, // apparent power l3
+        {WattNode::l1_current, copy, EM24_E1::l1_current, EM24_E1::last}, // current l1
+        {WattNode::l2_current, copy, EM24_E1::l2_current, EM24_E1::last}, // current l2
+        {WattNode::l3_current, copy, EM24_E1::l3_current, EM24_E1::last}, // current l3
+        {WattNode::demand_power_active, copy, EM24_E1::demand_power_active, EM24_E1::last}, // demand power
+        //{WattNode::minimum_demand_power_active, copy, EM24_E1::minimum_demand_power_active, EM24_E1::last}, // minimum demand power
+        {WattNode::maximum_demand_power_active, copy, EM24_E1::maximum_demand_power_active, EM24_E1::last}, // maximum demand power
+        {WattNode::demand_power_apparent, copy, EM24_E1::demand_power_apparent, EM24_E1::last}, // apparent demand power
+        //{WattNode::l1_demand_power_active, copy, EM24_E1::l1_demand_power_active, EM24_E1::last}, // demand power l1
+        //{WattNode::l2_demand_power_active, copy, EM24_E1::l2_demand_power_active, EM24_E1::last}, // demand power l2
+        //{WattNode::l3_demand_power_active, copy, EM24_E1::l3_demand_power_active, EM24_E1::last}, // demand power l3
+    };
+    for (const Rule &r : rules)
+    {
+        const RegisterReference &rr = _wattnode._device._dd._rr[r._target];
+        uint16_t address = _wattnode._device._dd._bds[rr._block_idx]._rds[rr._register_idx]._offset;
+        Step s{r._op, addSource(r._a), 0, _wattnode._device.registerIndex(r._target), address, false, 1, 0, 1, 1.0f};
+        if (r._op == sum || r._op == sum_third)
+            s._b = addSource(r._b);
+        // a + b / 3 is computed as (3a + b) / 3
+        uint8_t divisor = 1;
+        switch (r._op)
+        {
+        case copy:
+            break;
+        case sum:
+            s._kb = 1;
+            break;
+        case sum_third:
+            s._ka = 3;
+            s._kb = 1;
+            divisor = 3;
+            break;
+        case third:
+            divisor = 3;
+            break;
+        }
+        const RegisterDescription *a = _sources[s._a]._rd;
+        const RegisterDescription *b = _sources[s._b]._rd;
+        s._integer = a->_dataType != float32 && (s._kb == 0 || (b->_dataType != float32 && b->_scaling == a->_scaling));
+        s._divisor = s._integer ? divisor * getScaling(a->_scaling) : divisor;
+        s._multiplier = 1.0f / s._divisor;
+        _integer_steps += s._integer;
+        _steps.push_back(s);
+    }
+    // No generation seen yet, so the first run converts everything
+    _generations.resize(_meter._device._dd._bds.size(), 0xffffffff);
+    _changed.resize(_generations.size(), 0);
+}
+
+uint16_t modbus_gateway::ConvertEM24_E1ToWattNode::addSource(EM24_E1::e_registers r)
+{
+    for (auto i = _sources.begin(); i < _sources.end(); i++)
+    {
+        if (i->_register == r)
+            return i - _sources.begin();
+    }
+    const RegisterReference &rr = _meter._device._dd._rr[r];
+    _sources.push_back(Source{r, _meter._device.valueIndex(r), uint32_t(rr._block_idx), _meter._device.registerIndex(r),
+                              &_meter._device._dd._bds[rr._block_idx]._rds[rr._register_idx]});
+    return _sources.size() - 1;
+}
+
 void modbus_gateway::ConvertEM24_E1ToWattNode::CopyDataFromMasterToSlave()
 {   
     DataAccess <Server<WattNode>> wattnode(_wattnode);
-    DataAccess <Client<EM24_E1>> meter(_meter);
+    DataAccess <Aggregate<EM24_E1>> meter(_meter);
     //Serial.printf("CopyDateFromEM24ToWattnode\n\r");
-    // Block 1000
-    wattnode.setFloatValue(WattNode::energy_active, meter.getFloatValue(EM24_E1::import_energy_active)+meter.getFloatValue(EM24_E1::export_energy_active));// # total active energy
-    wattnode.setFloatValue(WattNode::import_energy_active, meter.getFloatValue(EM24_E1::import_energy_active));//  # imported active energy
-    wattnode.setFloatValue(WattNode::energy_active_nr, meter.getFloatValue(EM24_E1::import_energy_active)+meter.getFloatValue(EM24_E1::export_energy_active));//  # total active energy non-reset
-    wattnode.setFloatValue(WattNode::import_energy_active_nr, meter.getFloatValue(EM24_E1::import_energy_active));//  # imported active energy non-reset
-    wattnode.setFloatValue(WattNode::power_active, meter.getFloatValue(EM24_E1::power_active));//  # total power
-    wattnode.setFloatValue(WattNode::l1_power_active, meter.getFloatValue(EM24_E1::l1_power_active));
-    wattnode.setFloatValue(WattNode::l2_power_active, meter.getFloatValue(EM24_E1::l2_power_active));
-    wattnode.setFloatValue(WattNode::l3_power_active, meter.getFloatValue(EM24_E1::l3_power_active));
-    wattnode.setFloatValue(WattNode::voltage_ln, meter.getFloatValue(EM24_E1::voltage_ln));//  # l-n voltage
-    wattnode.setFloatValue(WattNode::l1n_voltage, meter.getFloatValue(EM24_E1::l1_voltage));//  # l1-n voltage
-    wattnode.setFloatValue(WattNode::l2n_voltage, meter.getFloatValue(EM24_E1::l2_voltage));//  # l2-n voltage
-    wattnode.setFloatValue(WattNode::l3n_voltage, meter.getFloatValue(EM24_E1::l3_voltage));//  # l3-n voltage
-    wattnode.setFloatValue(WattNode::voltage_ll, meter.getFloatValue(EM24_E1::voltage_ll));//  # l-l voltage
-    wattnode.setFloatValue(WattNode::l12_voltage, meter.getFloatValue(EM24_E1::l12_voltage));//  # l1-l2 voltage
-    wattnode.setFloatValue(WattNode::l23_voltage, meter.getFloatValue(EM24_E1::l23_voltage));//  # l2-l3 voltage
-    wattnode.setFloatValue(WattNode::l31_voltage, meter.getFloatValue(EM24_E1::l31_voltage));//  # l3-l1 voltage
-    wattnode.setFloatValue(WattNode::frequency, meter.getFloatValue(EM24_E1::frequency));//  # line frequency    
-    
-    // Block 1100
-    wattnode.setFloatValue(WattNode::l1_energy_active, meter.getFloatValue(EM24_E1::l1_import_energy_active)+meter.getFloatValue(EM24_E1::export_energy_active)/3); //  total active energy l1
-    wattnode.setFloatValue(WattNode::l2_energy_active, meter.getFloatValue(EM24_E1::l2_import_energy_active)+meter.getFloatValue(EM24_E1::export_energy_active)/3); //  total active energy l2
-    wattnode.setFloatValue(WattNode::l3_energy_active, meter.getFloatValue(EM24_E1::l3_import_energy_active)+meter.getFloatValue(EM24_E1::export_energy_active)/3); //  total active energy l3
-    wattnode.setFloatValue(WattNode::l1_import_energy_active, meter.getFloatValue(EM24_E1::l1_import_energy_active)); //  imported active energy l1
-    wattnode.setFloatValue(WattNode::l2_import_energy_active, meter.getFloatValue(EM24_E1::l2_import_energy_active)); //  imported active energy l2
-    wattnode.setFloatValue(WattNode::l3_import_energy_active, meter.getFloatValue(EM24_E1::l3_import_energy_active)); //  imported active energy l3
-    wattnode.setFloatValue(WattNode::export_energy_active, meter.getFloatValue(EM24_E1::export_energy_active)); //  total exported active energy
-    wattnode.setFloatValue(WattNode::export_energy_active_nr, meter.getFloatValue(EM24_E1::export_energy_active)); //  total exported active energy non-reset
-    wattnode.setFloatValue(WattNode::l1_export_energy_active, meter.getFloatValue(EM24_E1::export_energy_active)/3); //  exported energy l1
-    wattnode.setFloatValue(WattNode::l2_export_energy_active, meter.getFloatValue(EM24_E1::export_energy_active)/3); //  exported energy l2
-    wattnode.setFloatValue(WattNode::l3_export_energy_active, meter.getFloatValue(EM24_E1::export_energy_active)/3); //  exported energy l3
-    wattnode.setFloatValue(WattNode::energy_reactive, meter.getFloatValue(EM24_E1::import_energy_reactive) + meter.getFloatValue(EM24_E1::export_energy_reactive)); //  total reactive energy
-    //wattnode.setFloatValue(WattNode::l1_energy_reactive, meter.getFloatValue(EM24_E1::l1_energy_reactive)); //  reactive energy l1
-    //wattnode.setFloatValue(WattNode::l2_energy_reactive, meter.getFloatValue(EM24_E1::l2_energy_reactive)); //  reactive energy l2
-    //wattnode.setFloatValue(WattNode::l3_energy_reactive, meter.getFloatValue(EM24_E1::l3_energy_reactive)); //  reactive energy l3
-    //wattnode.setFloatValue(WattNode::energy_apparent, meter.getFloatValue(EM24_E1::energy_apparent)); //  total apparent energy
-    //wattnode.setFloatValue(WattNode::l1_energy_apparent, meter.getFloatValue(EM24_E1::l1_energy_apparent)); //  apparent energy l1
-    //wattnode.setFloatValue(WattNode::l2_energy_apparent, meter.getFloatValue(EM24_E1::l2_energy_apparent)); //  apparent energy l2
-    //wattnode.setFloatValue(WattNode::l3_energy_apparent, meter.getFloatValue(EM24_E1::l3_energy_apparent)); //  apparent energy l3
-    wattnode.setFloatValue(WattNode::power_factor, meter.getFloatValue(EM24_E1::total_pf)); //  power factor
-    wattnode.setFloatValue(WattNode::l1_power_factor, meter.getFloatValue(EM24_E1::l1_power_factor)); //  power factor l1
-    wattnode.setFloatValue(WattNode::l2_power_factor, meter.getFloatValue(EM24_E1::l2_power_factor)); //  power factor l2
-    wattnode.setFloatValue(WattNode::l3_power_factor, meter.getFloatValue(EM24_E1::l3_power_factor)); //  power factor l3
-    wattnode.setFloatValue(WattNode::power_reactive, meter.getFloatValue(EM24_E1::power_reactive)); //  total reactive power
-    wattnode.setFloatValue(WattNode::l1_power_reactive, meter.getFloatValue(EM24_E1::l1_power_reactive)); //  reactive power l1
-    wattnode.setFloatValue(WattNode::l2_power_reactive, meter.getFloatValue(EM24_E1::l2_power_reactive)); //  reactive power l2
-    wattnode.setFloatValue(WattNode::l3_power_reactive, meter.getFloatValue(EM24_E1::l3_power_reactive)); //  reactive power l3
-    wattnode.setFloatValue(WattNode::power_apparent, meter.getFloatValue(EM24_E1::power_apparent)); //  total apparent power
-    wattnode.setFloatValue(WattNode::l1_power_apparent, meter.getFloatValue(EM24_E1::l1_power_apparent)); //  apparent power l1
-    wattnode.setFloatValue(WattNode::l2_power_apparent, meter.getFloatValue(EM24_E1::l2_power_apparent)); //  apparent power l2
-    wattnode.setFloatValue(WattNode::l3_power_apparent, meter.getFloatValue(EM24_E1::l3_power_apparent)); //  apparent power l3
-    wattnode.setFloatValue(WattNode::l1_current, meter.getFloatValue(EM24_E1::l1_current)); //  current l1
-    wattnode.setFloatValue(WattNode::l2_current, meter.getFloatValue(EM24_E1::l2_current)); //  current l2
-    wattnode.setFloatValue(WattNode::l3_current, meter.getFloatValue(EM24_E1::l3_current)); //  current l3
-    wattnode.setFloatValue(WattNode::demand_power_active, meter.getFloatValue(EM24_E1::demand_power_active)); //  demand power
-    //wattnode.setFloatValue(WattNode::minimum_demand_power_active, meter.getFloatValue(EM24_E1::minimum_demand_power_active)); //  minimum demand power
-    wattnode.setFloatValue(WattNode::maximum_demand_power_active, meter.getFloatValue(EM24_E1::maximum_demand_power_active)); //  maximum demand power
-    wattnode.setFloatValue(WattNode::demand_power_apparent, meter.getFloatValue(EM24_E1::demand_power_apparent)); //  apparent demand power
-    //wattnode.setFloatValue(WattNode::l1_demand_power_active, meter.getFloatValue(EM24_E1::l1_demand_power_active)); //  demand power l1
-    //wattnode.setFloatValue(WattNode::l2_demand_power_active, meter.getFloatValue(EM24_E1::l2_demand_power_active)); //  demand power l2
-    //wattnode.setFloatValue(WattNode::l3_demand_power_active, meter.getFloatValue(EM24_E1::l3_demand_power_active)); //  demand power l3
+
+    bool any = false;
+    for (size_t b = 0; b < _generations.size(); b++)
+    {
+        uint32_t g = meter.generation(b);
+        _changed[b] = g != _generations[b];
+        _generations[b] = g;
+        any |= _changed[b];
+    }
+    _runs++;
+    _recomputed = 0;
+    _skipped = 0;
+    if (!any)
+    {
+        _skipped = _steps.size();
+        _total_skipped += _skipped;
+        return;
+    }
+
+    // Integer registers are read raw, the other ones were decoded when they arrived
+    const uint16_t *m = meter.image();
+    const float *decoded = meter.values();
+
+    uint16_t *w = wattnode.image();
+    for (auto s = _steps.begin(); s < _steps.end(); s++)
+    {
+        bool changed = _changed[_sources[s->_a]._block];
+        if (s->_op == sum || s->_op == sum_third)
+            changed |= _changed[_sources[s->_b]._block];
+        if (!changed)
+        {
+            _skipped++;
+            continue;
+        }
+        _recomputed++;
+
+        float f;
+        if (s->_integer)
+        {
+            int64_t x = s->_ka * _sources[s->_a]._rd->integer(&m[_sources[s->_a]._index]);
+            if (s->_kb != 0)
+                x += s->_kb * _sources[s->_b]._rd->integer(&m[_sources[s->_b]._index]);
+            // The integer part converts exactly up to 2^24, so only the fraction is rounded
+            int64_t q = x / s->_divisor;
+            f = float(q) + float(x - q * s->_divisor) * s->_multiplier;
+        }
+        else
+        {
+            f = s->_ka * decoded[_sources[s->_a]._value];
+            if (s->_kb != 0)
+                f += s->_kb * decoded[_sources[s->_b]._value];
+            f *= s->_multiplier;
+        }
+        Value v = Value::_float32_t(f);
+        w[s->_target] = v.w1;
+        w[s->_target + 1] = v.w2;
+    }
+    _total_recomputed += _recomputed;
+    _total_skipped += _skipped;
+
+    wattnode.publish();
+}
+
+std::vector<modbus_gateway::EM24_E1::e_registers> modbus_gateway::ConvertEM24_E1ToWattNode::sourceRegisters() const
+{
+    std::vector<EM24_E1::e_registers> result;
+    for (auto i = _sources.begin(); i < _sources.end(); i++)
+        result.push_back(i->_register);
+    return result;
+}
+
+uint32_t modbus_gateway::ConvertEM24_E1ToWattNode::sourceBlocks(uint16_t address, uint16_t words) const
+{
+    uint32_t result = 0;
+    for (auto s = _steps.begin(); s < _steps.end(); s++)
+    {
+        // Targets are float32, two registers
+        if (s->_address + 2 > address && s->_address < uint32_t(address) + words)
+        {
+            result |= 1u << _sources[s->_a]._block;
+            if (s->_op == sum || s->_op == sum_third)
+                result |= 1u << _sources[s->_b]._block;
+        }
+    }
+    return result;
+}
+
+String modbus_gateway::ConvertEM24_E1ToWattNode::statsAsString() const
+{
+    char buffer[200];
+    sprintf(buffer, "Conversion: runs=%u, last run recomputed=%u skipped=%u, total recomputed=%u skipped=%u, integer rules=%u/%u\r\n", _runs, _recomputed, _skipped, _total_recomputed, _total_skipped, _integer_steps, unsigned(_steps.size()));
+    return String(buffer);
 }
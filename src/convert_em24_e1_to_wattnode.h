@@ -13,20 +13,80 @@
 #include "wattnode.h"
 #include "server.h"
 #include "client.h"
+#include "aggregate.h"
 namespace modbus_gateway
 {
     class ConvertEM24_E1ToWattNode {
     public:
+        // How a WattNode register is computed from one or two EM24 registers
+        enum Operation
+        {
+            copy,      // a
+            sum,       // a + b
+            sum_third, // a + b / 3
+            third      // a / 3
+        };
+        struct Rule
+        {
+            WattNode::e_registers _target;
+            Operation _op;
+            EM24_E1::e_registers _a;
+            EM24_E1::e_registers _b;
+        };
 
-        ConvertEM24_E1ToWattNode(modbus_gateway::Client<EM24_E1>& meter, modbus_gateway::Server<WattNode>& wattnode)
-        : _meter(meter)
-        , _wattnode(wattnode)
-        {}
+        // Compiles the conversion rules into a plan of register indexes
+        ConvertEM24_E1ToWattNode(modbus_gateway::Aggregate<EM24_E1>& meter, modbus_gateway::Server<WattNode>& wattnode);
 
+        // Recomputes the WattNode registers whose EM24 source blocks changed since the previous run
         void CopyDataFromMasterToSlave();
 
-    private:       
-        modbus_gateway::Client<EM24_E1>&    _meter;
+        String statsAsString() const;
+        // The EM24 registers the conversion reads
+        std::vector<EM24_E1::e_registers> sourceRegisters() const;
+        // Bit b is set when EM24 block b feeds a WattNode register in the range
+        uint32_t sourceBlocks(uint16_t address, uint16_t words) const;
+
+    private:
+        // An EM24 register used by the rules, _value is its index in the decoded values of the meter,
+        // _index the index of its first word in the register image
+        struct Source
+        {
+            EM24_E1::e_registers _register;
+            uint32_t _value;
+            uint32_t _block;
+            uint32_t _index;
+            const RegisterDescription *_rd;
+        };
+        // Every operation is (_ka * a + _kb * b) / _divisor, with _multiplier = 1 / _divisor. When a and b
+        // are integers with the same scaling, the sum is exact in 64 bit and the scaling is part of the
+        // divisor; otherwise the decoded values are used.
+        struct Step
+        {
+            Operation _op;
+            uint16_t _a;
+            uint16_t _b;
+            uint32_t _target;
+            uint16_t _address;
+            bool _integer;
+            uint8_t _ka;
+            uint8_t _kb;
+            uint16_t _divisor;
+            float _multiplier;
+        };
+        uint16_t addSource(EM24_E1::e_registers r);
+
+        modbus_gateway::Aggregate<EM24_E1>&    _meter;
         modbus_gateway::Server<WattNode>& _wattnode;
+        std::vector<Source> _sources;
+        std::vector<Step> _steps;
+        // Per EM24 block: the generation seen by the previous run and whether it changed since
+        std::vector<uint32_t> _generations;
+        std::vector<uint8_t> _changed;
+        uint32_t _runs;
+        uint32_t _recomputed;
+        uint32_t _skipped;
+        uint32_t _total_recomputed;
+        uint32_t _total_skipped;
+        uint32_t _integer_steps;
     };
 }
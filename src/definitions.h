@@ -10,53 +10,15 @@
 
 #include <Arduino.h>
 #include <vector>
+#include <array>
+#include <iterator>
+#include <algorithm>
+#include <mutex>
 #include <time.h>
+#include "event_log.h"
 
 namespace modbus_gateway
 {
-    class Log
-    {
-    public:
-        Log()
-        {
-            _log.resize(_max);
-            _current = 0;
-        }
-        void addString(const String &s)
-        {
-            String v;
-            struct tm timeinfo;
-            getLocalTime(&timeinfo);
-            char buffer[100] = "";
-            sprintf(buffer, "%04u-%02u-%02u %u:%02u:%02u: ",
-                    1900 + timeinfo.tm_year, timeinfo.tm_mon, timeinfo.tm_mday, timeinfo.tm_hour, timeinfo.tm_min, timeinfo.tm_sec);
-            v = buffer;
-            v += s;
-            _log[_current++] = v;
-            if (_current >= _max)
-                _current = 0;
-        }
-
-        String allValuesAsString()
-        {
-            String r;
-
-            for (int i = 0; i < _max; i++)
-            {
-                int c = _current - i - 1;
-                if (c < 0)
-                    c += _max;
-                r += _log[c];
-                r += "\r\n";
-            }
-            return r;
-        }
-
-    private:
-        const int _max = 200;
-        int _current;
-        std::vector<String> _log;
-    };
     enum DataType
     {
         float32,
@@ -73,7 +35,7 @@ namespace modbus_gateway
         hundred = 100,
         thousand = 1000
     };
-    static uint16_t getScaling(Scaling s)
+    static constexpr uint16_t getScaling(Scaling s)
     {
         switch (s)
         {
@@ -103,7 +65,7 @@ namespace modbus_gateway
         }
         return 0;
     }
-    static uint16_t numberRegisters(DataType d)
+    static constexpr uint16_t numberRegisters(DataType d)
     {
         switch (d)
         {
@@ -122,35 +84,26 @@ namespace modbus_gateway
     }
     union Value
     {
-        static Value _uint32_t(uint32_t v)
+        constexpr Value() : ui32(0) {}
+        static constexpr Value _uint32_t(uint32_t v)
         {
-            Value r;
-            r.ui32 = v;
-            return r;
+            return Value(v);
         }
-        static Value _int32_t(int32_t v)
+        static constexpr Value _int32_t(int32_t v)
         {
-            Value r;
-            r.i32 = v;
-            return r;
+            return Value(v);
         }
-        static Value _int16_t(int16_t v)
+        static constexpr Value _int16_t(int16_t v)
         {
-            Value r;
-            r.i16 = v;
-            return r;
+            return Value(v);
         }
-        static Value _uint16_t(uint16_t v)
+        static constexpr Value _uint16_t(uint16_t v)
         {
-            Value r;
-            r.ui16 = v;
-            return r;
+            return Value(v);
         }
-        static Value _float32_t(float v)
+        static constexpr Value _float32_t(float v)
         {
-            Value r;
-            r.f32 = v;
-            return r;
+            return Value(v);
         }
         struct
         {
@@ -164,38 +117,49 @@ namespace modbus_gateway
             uint16_t w1;
             uint16_t w2;
         };
-        struct
-        {
-            uint16_t w;
-        };
-        struct
-        {
-            float f32;
-        };
-        struct
-        {
-            uint16_t ui16;
-        };
-        struct
-        {
-            int16_t i16;
-        };
-        struct
-        {
-            uint32_t ui32;
-        };
-        struct
-        {
-            int32_t i32;
-        };
+        uint16_t w;
+        float f32;
+        uint16_t ui16;
+        int16_t i16;
+        uint32_t ui32;
+        int32_t i32;
+
+    private:
+        constexpr explicit Value(uint32_t v) : ui32(v) {}
+        constexpr explicit Value(int32_t v) : i32(v) {}
+        constexpr explicit Value(int16_t v) : i16(v) {}
+        constexpr explicit Value(uint16_t v) : ui16(v) {}
+        constexpr explicit Value(float v) : f32(v) {}
+    };
+
+    // Read-only view on a constant array, so tables can be built at compile time and live in flash
+    template <typename T>
+    class ArrayView
+    {
+    public:
+        constexpr ArrayView() : _data(nullptr), _size(0) {}
+        constexpr ArrayView(const T *data, size_t size) : _data(data), _size(size) {}
+        template <size_t N>
+        constexpr ArrayView(const T (&data)[N]) : _data(data), _size(N) {}
+
+        constexpr const T *begin() const { return _data; }
+        constexpr const T *end() const { return _data + _size; }
+        constexpr size_t size() const { return _size; }
+        constexpr const T &operator[](size_t i) const { return _data[i]; }
+        constexpr const T &front() const { return _data[0]; }
+        constexpr const T &back() const { return _data[_size - 1]; }
+
+    private:
+        const T *_data;
+        size_t _size;
     };
 
     // RegisterReference. Avoid searching by string and instead use indexing
     struct RegisterReference
     {
-        String _desc;
-        int32_t _block_idx;
-        int32_t _register_idx;
+        const char *_desc = "";
+        int32_t _block_idx = -1;
+        int32_t _register_idx = -1;
     };
 
     // Register and Block Defintion
@@ -203,20 +167,32 @@ namespace modbus_gateway
     struct RegisterDefinition
     {
         using RegisterType = typename MODBUS_TYPE::e_registers;
-        const RegisterType _register;
-        const DataType _dataType;
-        const String _desc;
-        const String _unit;
-        const Scaling _scaling;
-        const Value _default;
-        const bool _wordorder;
+        RegisterType _register;
+        DataType _dataType;
+        const char *_desc;
+        const char *_unit;
+        Scaling _scaling;
+        Value _default;
+        bool _wordorder;
+        // Changes up to this much are not pushed to subscribers, see EventPush
+        float _deadband = 0;
     };
     template <typename MODBUS_TYPE>
     struct BlockDefinition
     {
-        const String _name;
-        const uint16_t _offset;
-        const std::vector<RegisterDefinition<MODBUS_TYPE>> _rd;
+        const char *_name;
+        uint16_t _offset;
+        ArrayView<RegisterDefinition<MODBUS_TYPE>> _rd;
+        // Polling: every _period ms, 0 is never. Priority 0 is the most important, lower priorities are
+        // shed first when the device is slow, until the values are older than _max_staleness ms.
+        uint32_t _period = 0;
+        uint8_t _priority = 0;
+        uint32_t _max_staleness = 0;
+        // A proxy may answer from values younger than _ttl ms, 0 is always ask the device
+        uint32_t _ttl = 0;
+        // The poll controller may shorten the period down to _min_period ms and lengthen it up to
+        // _max_staleness; 0 keeps _period
+        uint32_t _min_period = 0;
     };
 
     class RegisterDescription
@@ -224,8 +200,14 @@ namespace modbus_gateway
     public:
         String toString(const uint16_t *r) const
         {
-            String result = "unknown";
-            char buf[40] = {0};
+            char buf[40];
+            format(r, buf);
+            return buf;
+        }
+        // The value as text, buf holds at least 40 characters
+        void format(const uint16_t *r, char *buf) const
+        {
+            strcpy(buf, "unknown");
             Value v;
             switch (_dataType)
             {
@@ -241,7 +223,6 @@ namespace modbus_gateway
                     v.w1 = r[1];
                 }
                 sprintf(buf, "%.1f", v.f32 / getScaling(_scaling));
-                result = buf;
                 break;
             case int16:
                 v.w1 = r[0];
@@ -249,7 +230,6 @@ namespace modbus_gateway
                     sprintf(buf, "%i", v.i16);
                 else
                     sprintf(buf, "%.*f", getLogScaling(_scaling), float(v.i16) / getScaling(_scaling));
-                result = buf;
                 break;
             case uint16:
                 v.w1 = r[0];
@@ -257,7 +237,6 @@ namespace modbus_gateway
                     sprintf(buf, "%u", v.ui16);
                 else
                     sprintf(buf, "%.*f", getLogScaling(_scaling), float(v.ui16) / getScaling(_scaling));
-                result = buf;
                 break;
             case int32:
                 v.w1 = r[0];
@@ -266,7 +245,6 @@ namespace modbus_gateway
                     sprintf(buf, "%i", v.i32);
                 else
                     sprintf(buf, "%.*f", getLogScaling(_scaling), float(v.i32) / getScaling(_scaling));
-                result = buf;
                 break;
             case uint32:
                 v.w1 = r[0];
@@ -275,11 +253,83 @@ namespace modbus_gateway
                     sprintf(buf, "%u", v.ui32);
                 else
                     sprintf(buf, "%.*f", getLogScaling(_scaling), float(v.ui32) / getScaling(_scaling));
-                result = buf;
                 break;
             }
-
-            return result;
+        }
+        // The value as shown by format
+        float value(const uint16_t *r) const
+        {
+            Value v;
+            switch (_dataType)
+            {
+            case float32:
+                v.w1 = _wordorder ? r[0] : r[1];
+                v.w2 = _wordorder ? r[1] : r[0];
+                return v.f32 / getScaling(_scaling);
+            case int16:
+                v.w1 = r[0];
+                return float(v.i16) / getScaling(_scaling);
+            case uint16:
+                v.w1 = r[0];
+                return float(v.ui16) / getScaling(_scaling);
+            case int32:
+                v.w1 = r[0];
+                v.w2 = r[1];
+                return float(v.i32) / getScaling(_scaling);
+            case uint32:
+                v.w1 = r[0];
+                v.w2 = r[1];
+                return float(v.ui32) / getScaling(_scaling);
+            }
+            return 0;
+        }
+        // The unscaled value of an integer register, with the word order used by value. 0 for float32.
+        int64_t integer(const uint16_t *r) const
+        {
+            switch (_dataType)
+            {
+            case int16:
+                return int16_t(r[0]);
+            case uint16:
+                return r[0];
+            case int32:
+                return int32_t(uint32_t(r[0]) | uint32_t(r[1]) << 16);
+            case uint32:
+                return uint32_t(r[0]) | uint32_t(r[1]) << 16;
+            default:
+                return 0;
+            }
+        }
+        // The inverse of integer, values outside the data type are clamped
+        void setInteger(uint16_t *r, int64_t x) const
+        {
+            switch (_dataType)
+            {
+            case int16:
+                r[0] = uint16_t(int16_t(std::min<int64_t>(std::max<int64_t>(x, INT16_MIN), INT16_MAX)));
+                break;
+            case uint16:
+                r[0] = uint16_t(std::min<int64_t>(std::max<int64_t>(x, 0), UINT16_MAX));
+                break;
+            case int32:
+            case uint32:
+            {
+                uint32_t u = _dataType == int32 ? uint32_t(int32_t(std::min<int64_t>(std::max<int64_t>(x, INT32_MIN), INT32_MAX)))
+                                                : uint32_t(std::min<int64_t>(std::max<int64_t>(x, 0), UINT32_MAX));
+                r[0] = u & 0xffff;
+                r[1] = u >> 16;
+                break;
+            }
+            default:
+                break;
+            }
+        }
+        // Store a float32 register, the inverse of value without scaling
+        void setFloat32(uint16_t *r, float f) const
+        {
+            Value v = Value::_float32_t(f);
+            r[0] = _wordorder ? v.w1 : v.w2;
+            r[1] = _wordorder ? v.w2 : v.w1;
         }
         float toFloat32(const uint16_t *r) const
         {
@@ -356,81 +406,56 @@ namespace modbus_gateway
             }
             return v.i32;
         }
-        const uint16_t _offset;
-        const uint16_t _blockNbr;
-        const uint8_t _number;
-        const DataType _dataType;
-        const String _desc;
-        const String _unit;
-        const Scaling _scaling;
-        const Value _default;
-        const bool _wordorder; // True: order is high word, low word. False is the reverse
-
-    private:
-        template <typename MODBUS_TYPE>
-        friend class DeviceDescription;
-        RegisterDescription(uint16_t offset, uint16_t blockNbr, uint8_t number, DataType r_type, String desc, String unit, Scaling scaling, Value d, bool wordorder)
-            : _offset(offset), _blockNbr(blockNbr), _number(number), _dataType(r_type), _desc(desc), _unit(unit), _scaling(scaling), _default(d), _wordorder(wordorder)
-        {
-        }
+        uint16_t _offset = 0;
+        uint16_t _blockNbr = 0;
+        uint8_t _number = 0;
+        DataType _dataType = int16;
+        const char *_desc = "";
+        const char *_unit = "";
+        Scaling _scaling = none;
+        Value _default;
+        bool _wordorder = true; // True: order is high word, low word. False is the reverse
+        float _deadband = 0;
     };
 
     // Block
-    class BlockDescription
+    struct BlockDescription
     {
-    public:
-        ~BlockDescription() {}
-
-        const String _name;
-        const std::vector<RegisterDescription> _rds;
-        const uint16_t _offset = 0;
-        const uint16_t _number_reg = 0;
-
-    private:
-        template <typename MODBUS_TYPE>
-        friend class DeviceDescription;
-        BlockDescription(const String &name, const std::vector<RegisterDescription> &rds, uint16_t offset, uint16_t number_reg)
-            : _name(name), _rds(rds), _offset(offset), _number_reg(number_reg)
-        {
-        }
+        const char *_name = "";
+        ArrayView<RegisterDescription> _rds;
+        uint16_t _offset = 0;
+        uint16_t _number_reg = 0;
+        uint32_t _period = 0;
+        uint8_t _priority = 0;
+        uint32_t _max_staleness = 0;
+        uint32_t _ttl = 0;
+        uint32_t _min_period = 0;
     };
 
-    // Full description of the blocks and registers of a device, with a check that the registers in a block are contiguous
+    // Full description of the blocks and registers of a device
     template <typename MODBUS_TYPE>
     class DeviceDescription
     {
     public:
         using RegisterType = typename MODBUS_TYPE::e_registers;
-        static DeviceDescription makeDD(const char *name, const std::vector<BlockDefinition<MODBUS_TYPE>> &blocks)
-        {
-            std::vector<BlockDescription> bl;
-            std::vector<RegisterReference> rr;
-            rr.resize(RegisterType::last);
 
-            uint16_t blockNbr = 0;
-            for (auto i = blocks.begin(); i < blocks.end(); i++)
-            {
-                BlockDescription b = makeBlock(i->_name, blockNbr, i->_offset, i->_rd, rr);
-                blockNbr++;
-                bl.push_back(b);
-            }
-            return DeviceDescription(name, bl, rr);
-        }
+        constexpr DeviceDescription(const char *name, ArrayView<BlockDescription> bds, ArrayView<RegisterReference> rr)
+            : _name(name), _bds(bds), _rr(rr) {}
 
         // Get a description of the device
         String GetDescriptions() const
         {
             String result;
             char buf[200];
-            sprintf(buf, "Device: %s\r\n", _name.c_str());
+            sprintf(buf, "Device: %s\r\n", _name);
             result += buf;
             for (auto i = _bds.begin(); i < _bds.end(); i++)
             {
-                sprintf(buf, "  Block: %s, offset=0x%04x (%06u), numreg=%i\r\n", i->_name.c_str(), i->_offset, i->_offset, i->_number_reg);
+                sprintf(buf, "  Block: %s, offset=0x%04x (%06u), numreg=%i, period=%ums, priority=%u, max staleness=%ums, ttl=%ums, min period=%ums\r\n", i->_name, i->_offset, i->_offset, i->_number_reg, i->_period, i->_priority, i->_max_staleness, i->_ttl, i->_min_period);
                 result += buf;
                 for (auto j = i->_rds.begin(); j < i->_rds.end(); j++)
                 {
-                    sprintf(buf, "    Register 0x%04x (%06u): %s\r\n", j->_offset, j->_offset, j->_desc.c_str());
+                    sprintf(buf, "    Register 0x%04x (%06u): %s\r\n", j->_offset, j->_offset, j->_desc);
                     result += buf;
                 }
                 sprintf(buf, "\r\n");
@@ -439,57 +464,124 @@ namespace modbus_gateway
             return result;
         }
 
-        const String _name;
-        const std::vector<BlockDescription> _bds;
-        const std::vector<RegisterReference> _rr;
+        constexpr const RegisterDescription &registerDescription(RegisterType r) const
+        {
+            return _bds[_rr[r]._block_idx]._rds[_rr[r]._register_idx];
+        }
 
-    private:
-        DeviceDescription(const char *name, const std::vector<BlockDescription> &bds, std::vector<RegisterReference> rr) : _bds(bds), _name(name), _rr(rr) {}
-        static BlockDescription makeBlock(const String &name, uint16_t blockNbr, uint16_t offset, const std::vector<RegisterDefinition<MODBUS_TYPE>> &registers, std::vector<RegisterReference> &rr)
+        const char *_name;
+        const ArrayView<BlockDescription> _bds;
+        const ArrayView<RegisterReference> _rr;
+    };
+
+    // Number of registers over all blocks, to size a DeviceTable
+    template <typename MODBUS_TYPE, size_t NB>
+    constexpr size_t countRegisters(const BlockDefinition<MODBUS_TYPE> (&blocks)[NB])
+    {
+        size_t n = 0;
+        for (size_t b = 0; b < NB; b++)
+            n += blocks[b]._rd.size();
+        return n;
+    }
+
+    // Compile time table of a device, built from its block definitions. Register offsets follow from the
+    // data types, so the registers in a block are contiguous. Declare it constexpr so it is placed in flash
+    // and verify it with static_assert on complete() and ordered().
+    template <typename MODBUS_TYPE, size_t NB, size_t NR>
+    class DeviceTable
+    {
+    public:
+        using RegisterType = typename MODBUS_TYPE::e_registers;
+
+        constexpr DeviceTable(const char *name, const BlockDefinition<MODBUS_TYPE> (&blocks)[NB])
+            : _rds{}, _bds{}, _rr{}, _count{}, _dd(name, ArrayView<BlockDescription>(_bds.data(), NB), ArrayView<RegisterReference>(_rr.data(), RegisterType::last))
         {
-            std::vector<RegisterDescription> rl;
-            int number = 0;
+            size_t n = 0;
+            for (size_t b = 0; b < NB; b++)
+            {
+                size_t first = n;
+                uint16_t r_offset = blocks[b]._offset;
+                for (size_t r = 0; r < blocks[b]._rd.size(); r++)
+                {
+                    const RegisterDefinition<MODBUS_TYPE> &d = blocks[b]._rd[r];
+                    _rr[d._register] = RegisterReference{d._desc, int32_t(b), int32_t(r)};
+                    _count[d._register]++;
+                    _rds[n++] = RegisterDescription{r_offset, uint16_t(b), uint8_t(numberRegisters(d._dataType)), d._dataType, d._desc, d._unit, d._scaling, d._default, d._wordorder, d._deadband};
+                    r_offset += numberRegisters(d._dataType);
+                }
+                _bds[b] = BlockDescription{blocks[b]._name, ArrayView<RegisterDescription>(_rds.data() + first, n - first), blocks[b]._offset, uint16_t(r_offset - blocks[b]._offset),
+                                          blocks[b]._period, blocks[b]._priority, blocks[b]._max_staleness, blocks[b]._ttl, blocks[b]._min_period};
+            }
+        }
 
-            uint16_t r_offset = offset;
-            for (auto i = registers.begin(); i < registers.end(); i++)
+        // Every register of e_registers is defined exactly once
+        constexpr bool complete() const
+        {
+            for (size_t r = 0; r < RegisterType::last; r++)
             {
-                rr[int32_t(i->_register)] = RegisterReference{i->_desc, blockNbr, i - registers.begin()};
-                RegisterDescription r(r_offset, blockNbr, numberRegisters(i->_dataType), i->_dataType, i->_desc, i->_unit, i->_scaling, i->_default, i->_wordorder);
-                rl.push_back(r);
-                number += numberRegisters(i->_dataType);
-                r_offset += numberRegisters(i->_dataType);
+                if (_count[r] != 1)
+                    return false;
             }
+            return true;
+        }
 
-            return BlockDescription(name, rl, offset, number);
+        // Blocks are sorted by offset and do not overlap
+        constexpr bool ordered() const
+        {
+            for (size_t b = 1; b < NB; b++)
+            {
+                if (uint32_t(_bds[b - 1]._offset) + _bds[b - 1]._number_reg > _bds[b]._offset)
+                    return false;
+            }
+            return true;
         }
+
+        constexpr const DeviceDescription<MODBUS_TYPE> &description() const { return _dd; }
+
+    private:
+        std::array<RegisterDescription, NR> _rds;
+        std::array<BlockDescription, NB> _bds;
+        std::array<RegisterReference, RegisterType::last> _rr;
+        std::array<uint8_t, RegisterType::last> _count;
+        DeviceDescription<MODBUS_TYPE> _dd;
     };
 
-    // Block. This contains values for a block.
+    // Block. This contains values for a block. The registers live in the register image of the Device.
     class Block
     {
     public:
-        Block(const BlockDescription &bd, int32_t _number_reg) : _bd(bd), _transaction(0) { _registers.resize(_number_reg); }
+        Block(const BlockDescription &bd, uint16_t *registers, float *values) : _bd(bd), _registers(registers), _values(values), _transaction(0), _generation(0) {}
 
         const BlockDescription &_bd;
 
-    private:
-        String allValuesAsString() const
+        // Format the block values from registers laid out like the block, out(const char *) receives
+        // the text line by line
+        template <typename OUT>
+        void format(const uint16_t *registers, uint32_t transaction, uint32_t generation, OUT out) const
         {
-            String result;
-            char buf[200] = {0};
+            char buf[200];
+            char value[40];
 
             // Transaction id
-            sprintf(buf, "TransactionID=%i\r\n", _transaction);
-            result = result += buf;
-            sprintf(buf, "Block %s\r\n", _bd._name.c_str());
-            result = result += buf;
+            sprintf(buf, "TransactionID=%u, Generation=%u\r\n", transaction, generation);
+            out(buf);
+            sprintf(buf, "Block %s\r\n", _bd._name);
+            out(buf);
 
             for (auto i = _bd._rds.begin(); i < _bd._rds.end(); i++)
             {
-                String value = i->toString(&(_registers[i->_offset - _bd._offset]));
-                sprintf(buf, "  %s=%s %s\n", i->_desc.c_str(), value.c_str(), i->_unit);
-                result += buf;
+                i->format(&(registers[i->_offset - _bd._offset]), value);
+                snprintf(buf, sizeof(buf), "  %s=%s %s\n", i->_desc, value, i->_unit);
+                out(buf);
             }
+        }
+
+    private:
+        String allValuesAsString() const
+        {
+            String result;
+            format(_registers, _transaction, _generation, [&](const char *s)
+                   { result += s; });
             return result;
         }
         float getFloatValue(const RegisterDescription &r) const
@@ -526,6 +618,11 @@ namespace modbus_gateway
             _registers[r._offset - _bd._offset] = v.w1;
             _registers[r._offset - _bd._offset + 1] = v.w2;
         }
+        void setInt16Value(const RegisterReference &rr, int16_t f)
+        {
+            const RegisterDescription &r = _bd._rds[rr._register_idx];
+            _registers[r._offset - _bd._offset] = Value::_int16_t(f).w;
+        }
         void setInt32Value(const RegisterReference &rr, int32_t f)
         {
             const RegisterDescription &r = _bd._rds[rr._register_idx];
@@ -544,8 +641,15 @@ namespace modbus_gateway
         template <typename T>
         friend class Device;
 
-        std::vector<uint16_t> _registers;
-        uint16_t _transaction;
+        uint16_t *_registers;
+        // The decoded and scaled value of every register of the block, in the order of _bd._rds
+        float *_values;
+        uint32_t _transaction;
+        // Incremented every time new values for the block are stored
+        uint32_t _generation;
+        // The runs of Device::_runs that decode the block
+        uint32_t _first_run = 0;
+        uint32_t _nbr_runs = 0;
     };
 
     template <typename MODBUS_TYPE>
@@ -553,12 +657,51 @@ namespace modbus_gateway
     {
     public:
         using RegisterType = typename MODBUS_TYPE::e_registers;
-        Device(const DeviceDescription<MODBUS_TYPE> &dd) : _dd(dd)
+        Device(const DeviceDescription<MODBUS_TYPE> &dd) : _dd(dd), _begin(0xffff), _end(0)
         {
+            // All registers of the device are kept in one image, indexed by modbus address through a page table.
+            // Only pages holding registers get a slot. Slots are handed out in address order, so pages that
+            // are adjacent on the bus are adjacent in the image and a range read is one pass over the image.
             for (auto i = _dd._bds.begin(); i < _dd._bds.end(); i++)
             {
-                Block b(*i, i->_number_reg);
-                modbus_gateway::Value v;
+                if (i->_number_reg == 0)
+                    continue;
+                _begin = std::min<uint32_t>(_begin, i->_offset);
+                _end = std::max<uint32_t>(_end, i->_offset + i->_number_reg);
+            }
+            _pages.assign((_end + _page_size - 1) >> _page_shift, -1);
+            for (auto i = _dd._bds.begin(); i < _dd._bds.end(); i++)
+            {
+                for (uint32_t p = i->_offset >> _page_shift; p < (uint32_t(i->_offset) + i->_number_reg + _page_size - 1) >> _page_shift; p++)
+                    _pages[p] = 0;
+            }
+            int16_t slots = 0;
+            for (auto p = _pages.begin(); p < _pages.end(); p++)
+            {
+                if (*p >= 0)
+                    *p = slots++;
+            }
+            _image.assign(uint32_t(slots) << _page_shift, 0);
+
+            size_t registers = 0;
+            for (auto i = _dd._bds.begin(); i < _dd._bds.end(); i++)
+                registers += i->_rds.size();
+            _values.assign(registers, 0);
+            _scales.reserve(registers);
+
+            for (auto i = _dd._bds.begin(); i < _dd._bds.end(); i++)
+            {
+                Block b(*i, i->_number_reg > 0 ? &_image[imageIndex(i->_offset)] : _image.data(), _values.data() + _scales.size());
+                // Registers of the same type follow each other in the image, so they are decoded in one loop
+                b._first_run = _runs.size();
+                for (auto j = i->_rds.begin(); j < i->_rds.end(); j++)
+                {
+                    if (j == i->_rds.begin() || _runs.back()._type != j->_dataType || _runs.back()._wordorder != j->_wordorder)
+                        _runs.push_back(Run{j->_dataType, j->_wordorder, uint32_t(_scales.size()), imageIndex(j->_offset), 0});
+                    _runs.back()._count++;
+                    _scales.push_back(getScaling(j->_scaling));
+                }
+                b._nbr_runs = _runs.size() - b._first_run;
                 for (auto j = i->_rds.begin(); j < i->_rds.end(); j++)
                 {
                     switch (j->_number)
@@ -574,19 +717,295 @@ namespace modbus_gateway
                 }
                 _blocks.push_back(b);
             }
+            decode();
         }
+        Device(const Device &) = delete;
+        Device &operator=(const Device &) = delete;
+
         uint32_t GetBlockIndex(const String &name) const
         {
             for (auto i = _dd._bds.begin(); i < _dd._bds.end(); i++)
             {
-                if (i->_name == name)
+                if (name == i->_name)
                     return i - _dd._bds.begin();
             }
             return -1;
         }
+        // True when the range lies within the first and last register of the device.
+        // Holes between blocks are part of the range and read as 0.
+        bool containsRange(uint16_t address, uint16_t words) const
+        {
+            return words > 0 && address >= _begin && uint32_t(address) + words <= _end;
+        }
+        // One past the last register of the device
+        uint32_t endAddress() const
+        {
+            return _end;
+        }
+        // Copy a range of registers as big endian bytes, as used on the wire, from an image laid out like
+        // the one of this device (e.g. a published copy). Runs of pages present in the image are copied
+        // in one pass, pages without registers are filled with 0. The page table never changes after
+        // construction, so this needs no lock.
+        void readRegisters(const uint16_t *image, uint16_t address, uint16_t words, uint8_t *bytes) const
+        {
+            uint32_t a = address;
+            const uint32_t end = uint32_t(address) + words;
+            while (a < end)
+            {
+                uint32_t page = a >> _page_shift;
+                uint32_t run_end = (page + 1) << _page_shift;
+                bool present = _pages[page] >= 0;
+                while (run_end < end && ((_pages[run_end >> _page_shift] >= 0) == present))
+                    run_end += _page_size;
+                uint32_t n = std::min(run_end, end) - a;
+                if (present)
+                {
+                    const uint16_t *r = &image[imageIndex(a)];
+                    for (uint32_t i = 0; i < n; i++)
+                    {
+                        *bytes++ = r[i] >> 8;
+                        *bytes++ = r[i] & 0xff;
+                    }
+                }
+                else
+                {
+                    memset(bytes, 0, n * 2);
+                    bytes += n * 2;
+                }
+                a += n;
+            }
+        }
+        // Index of the first word of a register in the register image
+        uint32_t registerIndex(RegisterType r) const
+        {
+            const RegisterReference &rr = _dd._rr[r];
+            return imageIndex(_dd._bds[rr._block_idx]._rds[rr._register_idx]._offset);
+        }
+        // The values of all blocks, copied with the device locked by DataAccess::copyValues
+        struct Values
+        {
+            std::vector<uint16_t> _image;
+            std::vector<float> _values;
+            std::vector<uint32_t> _transactions;
+            std::vector<uint32_t> _generations;
+        };
+        // Format copied values, like allValuesAsString. The layout of the image never changes after
+        // construction, so this needs no lock.
+        template <typename OUT>
+        void formatValues(const Values &v, OUT out) const
+        {
+            for (size_t b = 0; b < _blocks.size(); b++)
+                _blocks[b].format(blockRegisters(v, b), v._transactions[b], v._generations[b], out);
+        }
+        // The registers of block b in copied values
+        const uint16_t *blockRegisters(const Values &v, size_t b) const
+        {
+            return v._image.data() + (_blocks[b]._registers - _image.data());
+        }
+        // The decoded values of block b in copied values, in the order of its register descriptions
+        const float *blockValues(const Values &v, size_t b) const
+        {
+            return v._values.data() + (_blocks[b]._values - _values.data());
+        }
+        // Decode the registers of a block into its values, run by run
+        void decode(uint32_t block_idx)
+        {
+            const Block &b = _blocks[block_idx];
+            for (uint32_t r = b._first_run; r < b._first_run + b._nbr_runs; r++)
+                decodeRun(_runs[r]);
+        }
+        void decode()
+        {
+            for (auto r = _runs.begin(); r < _runs.end(); r++)
+                decodeRun(*r);
+        }
+        // Decoded value of a register, as decoded by the last setTransaction or decode
+        float getValue(RegisterType r) const
+        {
+            const RegisterReference &rr = _dd._rr[r];
+            return _blocks[rr._block_idx]._values[rr._register_idx];
+        }
+        // Index of a register in values()
+        uint32_t valueIndex(RegisterType r) const
+        {
+            const RegisterReference &rr = _dd._rr[r];
+            return (_blocks[rr._block_idx]._values - _values.data()) + rr._register_idx;
+        }
+        // Same for every block that has registers in the range
+        void setTransaction(uint16_t address, uint16_t words, uint32_t t)
+        {
+            for (uint32_t b = 0; b < _blocks.size(); b++)
+            {
+                const BlockDescription &bd = _blocks[b]._bd;
+                if (bd._number_reg > 0 && bd._offset < uint32_t(address) + words && address < uint32_t(bd._offset) + bd._number_reg)
+                    setTransaction(b, t);
+            }
+        }
+        // Typed read of register R: its place in the image, data type, word order and scaling are resolved
+        // at compile time from MODBUS_TYPE::getDeviceDescription(). Divides by the scaling like decodeRun,
+        // so the result equals getValue(R) to the last bit.
+        template <RegisterType R>
+        float get() const
+        {
+            constexpr const RegisterDescription &d = MODBUS_TYPE::getDeviceDescription().registerDescription(R);
+            constexpr uint32_t index = layoutIndex(MODBUS_TYPE::getDeviceDescription(), d._offset);
+            constexpr float scale = getScaling(d._scaling);
+            return decode<d._dataType, d._wordorder>(&_image[index]) / scale;
+        }
         const DeviceDescription<MODBUS_TYPE> &_dd;
 
     private:
+        static constexpr uint16_t _page_shift = 5;
+        static constexpr uint16_t _page_size = 1 << _page_shift;
+        static constexpr uint16_t _page_mask = _page_size - 1;
+
+        // imageIndex as laid out by the constructor, computed from the description alone
+        static constexpr uint32_t layoutIndex(const DeviceDescription<MODBUS_TYPE> &dd, uint16_t address)
+        {
+            uint32_t slot = 0;
+            for (uint32_t p = 0; p < uint32_t(address >> _page_shift); p++)
+            {
+                for (size_t b = 0; b < dd._bds.size(); b++)
+                {
+                    const BlockDescription &bd = dd._bds[b];
+                    if (bd._number_reg > 0 && p >= uint32_t(bd._offset >> _page_shift) && p < (uint32_t(bd._offset) + bd._number_reg + _page_size - 1) >> _page_shift)
+                    {
+                        slot++;
+                        break;
+                    }
+                }
+            }
+            return (slot << _page_shift) | (address & _page_mask);
+        }
+        // Registers of one data type and word order that follow each other in a block
+        struct Run
+        {
+            DataType _type;
+            bool _wordorder;
+            uint32_t _value;
+            uint32_t _index;
+            uint16_t _count;
+        };
+        // Plain loops without branches per register, so the compiler can vectorize them. Divided by the
+        // scaling like RegisterDescription::value, so the values are the same to the last bit.
+        void decodeRun(const Run &run)
+        {
+            const uint16_t *r = &_image[run._index];
+            const float *scale = &_scales[run._value];
+            float *out = &_values[run._value];
+            const uint16_t n = run._count;
+            switch (run._type)
+            {
+            case int16:
+                for (uint16_t i = 0; i < n; i++)
+                    out[i] = float(int16_t(r[i])) / scale[i];
+                break;
+            case uint16:
+                for (uint16_t i = 0; i < n; i++)
+                    out[i] = float(r[i]) / scale[i];
+                break;
+            case int32:
+                for (uint16_t i = 0; i < n; i++)
+                    out[i] = float(int32_t(uint32_t(r[2 * i]) | uint32_t(r[2 * i + 1]) << 16)) / scale[i];
+                break;
+            case uint32:
+                for (uint16_t i = 0; i < n; i++)
+                    out[i] = float(uint32_t(r[2 * i]) | uint32_t(r[2 * i + 1]) << 16) / scale[i];
+                break;
+            case float32:
+                for (uint16_t i = 0; i < n; i++)
+                {
+                    uint32_t u = run._wordorder ? uint32_t(r[2 * i]) | uint32_t(r[2 * i + 1]) << 16
+                                                : uint32_t(r[2 * i + 1]) | uint32_t(r[2 * i]) << 16;
+                    float f;
+                    memcpy(&f, &u, 4);
+                    out[i] = f / scale[i];
+                }
+                break;
+            }
+        }
+        template <DataType TYPE, bool WORDORDER>
+        static float decode(const uint16_t *r)
+        {
+            Value v;
+            if constexpr (TYPE == float32)
+            {
+                v.w1 = WORDORDER ? r[0] : r[1];
+                v.w2 = WORDORDER ? r[1] : r[0];
+                return v.f32;
+            }
+            else if constexpr (TYPE == int16)
+            {
+                v.w1 = r[0];
+                return v.i16;
+            }
+            else if constexpr (TYPE == uint16)
+                return r[0];
+            else
+            {
+                v.w1 = r[0];
+                v.w2 = r[1];
+                return TYPE == int32 ? float(v.i32) : float(v.ui32);
+            }
+        }
+
+        uint32_t imageIndex(uint16_t address) const
+        {
+            return (uint32_t(_pages[address >> _page_shift]) << _page_shift) | (address & _page_mask);
+        }
+
+        void readRegisters(uint16_t address, uint16_t words, uint8_t *bytes) const
+        {
+            readRegisters(_image.data(), address, words, bytes);
+        }
+        void copyImage(std::vector<uint16_t> &image) const
+        {
+            image.assign(_image.begin(), _image.end());
+        }
+        uint16_t *image()
+        {
+            return _image.data();
+        }
+        // Write a register by modbus address. Writes to pages without registers are ignored.
+        void writeRegister(uint16_t address, uint16_t val)
+        {
+            if ((address >> _page_shift) < _pages.size() && _pages[address >> _page_shift] >= 0)
+                _image[imageIndex(address)] = val;
+        }
+        // Write a range of registers from big endian bytes, as received on the wire. The inverse of
+        // readRegisters: runs of present pages are converted in one pass, words for pages without registers
+        // and beyond the device are skipped.
+        void writeRegisters(uint16_t address, uint16_t words, const uint8_t *bytes)
+        {
+            uint32_t a = address;
+            const uint32_t end = std::min<uint32_t>(uint32_t(address) + words, _pages.size() << _page_shift);
+            while (a < end)
+            {
+                uint32_t page = a >> _page_shift;
+                uint32_t run_end = (page + 1) << _page_shift;
+                bool present = _pages[page] >= 0;
+                while (run_end < end && ((_pages[run_end >> _page_shift] >= 0) == present))
+                    run_end += _page_size;
+                uint32_t n = std::min(run_end, end) - a;
+                if (present)
+                    fromBigEndian(bytes, n, &_image[imageIndex(a)]);
+                bytes += n * 2;
+                a += n;
+            }
+        }
+        // Plain loads and a byte swap, which the compiler turns into vector instructions where it has them
+        static void fromBigEndian(const uint8_t *bytes, uint32_t words, uint16_t *r)
+        {
+            for (uint32_t i = 0; i < words; i++)
+            {
+                uint16_t w;
+                memcpy(&w, bytes + i * 2, 2);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+                w = __builtin_bswap16(w);
+#endif
+                r[i] = w;
+            }
+        }
         // Plain uint16_t values access
         void setRegisterValue(uint32_t block_idx, uint32_t val_index, uint16_t val)
         {
@@ -598,42 +1017,42 @@ namespace modbus_gateway
         }
         void setFloatValue(RegisterType r, float i)
         {
-            RegisterReference rr = _dd._rr[r];
+            const RegisterReference &rr = _dd._rr[r];
             if (rr._block_idx >= 0 && rr._register_idx >= 0)
             {
                 _blocks[rr._block_idx].setFloatValue(rr, i);
-                // Serial.printf("setFloatValue %s %i %i %i %i=%f\r\n", rr._desc.c_str(), rr._block_idx, rr._register_idx, r._blockNbr, r._offset, i);
+                // Serial.printf("setFloatValue %s %i %i %i %i=%f\r\n", rr._desc, rr._block_idx, rr._register_idx, r._blockNbr, r._offset, i);
             }
             else
             {
-                Serial.printf("modbus_gateway::ConvertEM24ToWattNode::setFloatValue invalid reference for register %s %i %i\r\n", rr._desc.c_str(), rr._block_idx, rr._register_idx);
+                Serial.printf("modbus_gateway::ConvertEM24ToWattNode::setFloatValue invalid reference for register %s %i %i\r\n", rr._desc, rr._block_idx, rr._register_idx);
             }
         }
         float getFloatValue(RegisterType r)
         {
             float f = 0;
-            RegisterReference rr = _dd._rr[r];
+            const RegisterReference &rr = _dd._rr[r];
             if (rr._block_idx >= 0 && rr._register_idx >= 0)
             {
                 f = _blocks[rr._block_idx].getFloatValue(rr);
             }
             else
             {
-                Serial.printf("Can't find value %s %i %i\r\n", rr._desc.c_str(), rr._block_idx, rr._register_idx);
+                Serial.printf("Can't find value %s %i %i\r\n", rr._desc, rr._block_idx, rr._register_idx);
             }
             return f;
         }
         float getInt16Value(RegisterType r)
         {
             int16_t i = 0;
-            RegisterReference rr = _dd._rr[r];
+            const RegisterReference &rr = _dd._rr[r];
             if (rr._block_idx >= 0 && rr._register_idx >= 0)
             {
                 i = _blocks[rr._block_idx].getInt16Value(rr);
             }
             else
             {
-                Serial.printf("Can't find value %s %i %i\r\n", rr._desc.c_str(), rr._block_idx, rr._register_idx);
+                Serial.printf("Can't find value %s %i %i\r\n", rr._desc, rr._block_idx, rr._register_idx);
             }
             return i;
         }
@@ -641,32 +1060,52 @@ namespace modbus_gateway
         uint32_t getInt32Value(RegisterType r)
         {
             uint32_t i = 0;
-            RegisterReference rr = _dd._rr[r];
+            const RegisterReference &rr = _dd._rr[r];
             if (rr._block_idx >= 0 && rr._register_idx >= 0)
             {
                 i = _blocks[rr._block_idx].getInt32Value(rr);
             }
             else
             {
-                Serial.printf("Can't find value %s %i %i\r\n", rr._desc.c_str(), rr._block_idx, rr._register_idx);
+                Serial.printf("Can't find value %s %i %i\r\n", rr._desc, rr._block_idx, rr._register_idx);
             }
             return i;
         }
+        void setInt16Value(RegisterType r, int16_t i)
+        {
+            const RegisterReference &rr = _dd._rr[r];
+            if (rr._block_idx >= 0 && rr._register_idx >= 0)
+            {
+                _blocks[rr._block_idx].setInt16Value(rr, i);
+            }
+            else
+            {
+                Serial.printf("Can't find value %s %i %i\r\n", rr._desc, rr._block_idx, rr._register_idx);
+            }
+        }
         void setInt32Value(RegisterType r, uint32_t i)
         {
-            RegisterReference rr = _dd._rr[r];
+            const RegisterReference &rr = _dd._rr[r];
             if (rr._block_idx >= 0 && rr._register_idx >= 0)
             {
                 _blocks[rr._block_idx].setInt32Value(rr, i);
             }
             else
             {
-                Serial.printf("Can't find value %s %i %i\r\n", rr._desc.c_str(), rr._block_idx, rr._register_idx);
+                Serial.printf("Can't find value %s %i %i\r\n", rr._desc, rr._block_idx, rr._register_idx);
             }
         }
+        // Records the transaction that delivered the block values, bumps the generation of the block and
+        // decodes its values
         void setTransaction(uint32_t block_idx, uint32_t t)
         {
-            _blocks[block_idx]._transaction - t;
+            _blocks[block_idx]._transaction = t;
+            _blocks[block_idx]._generation++;
+            decode(block_idx);
+        }
+        uint32_t generation(uint32_t block_idx) const
+        {
+            return _blocks[block_idx]._generation;
         }
         String allValuesAsString() const
         {
@@ -675,8 +1114,28 @@ namespace modbus_gateway
                 r += i->allValuesAsString();
             return r;
         }
+        void copyValues(Values &v) const
+        {
+            v._image.assign(_image.begin(), _image.end());
+            v._values.assign(_values.begin(), _values.end());
+            v._transactions.resize(_blocks.size());
+            v._generations.resize(_blocks.size());
+            for (size_t b = 0; b < _blocks.size(); b++)
+            {
+                v._transactions[b] = _blocks[b]._transaction;
+                v._generations[b] = _blocks[b]._generation;
+            }
+        }
         template <typename T>
         friend class DataAccess;
+        std::vector<uint16_t> _image;
+        std::vector<int16_t> _pages;
+        // Decoded values of all blocks, with the scaling and the runs to decode them
+        std::vector<float> _values;
+        std::vector<float> _scales;
+        std::vector<Run> _runs;
+        uint32_t _begin;
+        uint32_t _end;
         std::vector<Block> _blocks;
     };
 
@@ -711,15 +1170,43 @@ namespace modbus_gateway
             return _s._device.getRegisterValue(block_idx, val_index);
         }
 
+        // Register access by modbus address, see Device
+        void readRegisters(uint16_t address, uint16_t words, uint8_t *bytes) const
+        {
+            _s._device.readRegisters(address, words, bytes);
+        }
+        void writeRegister(uint16_t address, uint16_t val)
+        {
+            _s._device.writeRegister(address, val);
+        }
+        void writeRegisters(uint16_t address, uint16_t words, const uint8_t *bytes)
+        {
+            _s._device.writeRegisters(address, words, bytes);
+        }
+
         void setTransaction(uint32_t block_idx, uint32_t t)
         {
             _s._device.setTransaction(block_idx, t);
         }
+        void setTransaction(uint16_t address, uint16_t words, uint32_t t)
+        {
+            _s._device.setTransaction(address, words, t);
+        }
+        uint32_t generation(uint32_t block_idx) const
+        {
+            return _s._device.generation(block_idx);
+        }
 
         String allValuesAsString() const
         {
             return _s._device.allValuesAsString();
         }
+        // Copy the values to format them after the lock is released, see Device::formatValues
+        template <typename VALUES>
+        void copyValues(VALUES &v) const
+        {
+            _s._device.copyValues(v);
+        }
 
         void setFloatValue(RegisterType r, float i)
         {
@@ -729,10 +1216,39 @@ namespace modbus_gateway
         {
             return _s._device.getFloatValue(r);
         }
+        // See Device::getValue and Device::valueIndex
+        float getValue(RegisterType r) const
+        {
+            return _s._device.getValue(r);
+        }
+        // The decoded values of the device. Only valid while this DataAccess exists.
+        const float *values() const
+        {
+            return _s._device._values.data();
+        }
+        // See Device::get
+        template <RegisterType R>
+        float get() const
+        {
+            return _s._device.template get<R>();
+        }
         float getInt16Value(RegisterType r)
         {
             return _s._device.getInt16Value(r);
         }
+        void setInt16Value(RegisterType r, int16_t i)
+        {
+            _s._device.setInt16Value(r, i);
+        }
+        void copyImage(std::vector<uint16_t> &image) const
+        {
+            _s._device.copyImage(image);
+        }
+        // The register image, see Device::registerIndex. Only valid while this DataAccess exists.
+        uint16_t *image()
+        {
+            return _s._device.image();
+        }
         void setInt32Value(RegisterType r, int32_t i)
         {
             _s._device.setInt32Value(r, i);
@@ -746,9 +1262,15 @@ namespace modbus_gateway
             return _s._log.allValuesAsString();
         }
 
-        void logMessage(String m)
+        // Signal that a consistent set of values has been written
+        void publish()
+        {
+            _s.publish(*this);
+        }
+
+        void logEvent(Event e, int32_t a0 = 0, int32_t a1 = 0, int32_t a2 = 0, int32_t a3 = 0, int32_t a4 = 0)
         {
-            _s._log.addString(m);
+            _s._log.add(e, a0, a1, a2, a3, a4);
         }
 
     private:
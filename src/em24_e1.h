@@ -16,9 +16,10 @@ namespace modbus_gateway
     class EM24_E1
     {
     public:
-        static const DeviceDescription<EM24_E1> &getDeviceDescription();
+        // Defined below the class, so Device::get can resolve registers at compile time
+        static constexpr const DeviceDescription<EM24_E1> &getDeviceDescription();
 
-        // All defined registers. See the definition of each register in the .cpp file
+        // All defined registers. See the definition of each register below
         enum e_registers
         {
             l1_voltage,
@@ -78,6 +79,91 @@ namespace modbus_gateway
             maximum_demand_current,
             last
         };
+
+        // The definitions of the registers by block
+        static const RegisterDefinition<EM24_E1> dynamic_registers[];
+        static const RegisterDefinition<EM24_E1> energy_registers[];
+        static const RegisterDefinition<EM24_E1> time_registers[];
+        static const RegisterDefinition<EM24_E1> tariff_registers[];
+        static const BlockDefinition<EM24_E1> blocks[];
+    };
+
+    // Protocol for EM24_E1 register list:
+    //   https://www.enika.eu/data/files/produkty/energy%20m/CP/em24%20ethernet%20cp.pdf
+    inline constexpr RegisterDefinition<EM24_E1> EM24_E1::dynamic_registers[] = {
+        {l1_voltage, DataType::int32, "L1 Voltage", "V", Scaling::ten, Value::_int32_t(0), true, 0.5},
+        {l2_voltage, DataType::int32, "L2 Voltage", "V", Scaling::ten, Value::_int32_t(0), true, 0.5},
+        {l3_voltage, DataType::int32, "L3 Voltage", "V", Scaling::ten, Value::_int32_t(0), true, 0.5},
+        {l12_voltage, DataType::int32, "L1-L2 Voltage", "V", Scaling::ten, Value::_int32_t(0), true, 0.5},
+        {l23_voltage, DataType::int32, "L2-L3 Voltage", "V", Scaling::ten, Value::_int32_t(0), true, 0.5},
+        {l31_voltage, DataType::int32, "L3-L1 Voltage", "V", Scaling::ten, Value::_int32_t(0), true, 0.5},
+        {l1_current, DataType::int32, "L1 Current", "A", Scaling::thousand, Value::_int32_t(0), true, 0.05},
+        {l2_current, DataType::int32, "L2 Current", "A", Scaling::thousand, Value::_int32_t(0), true, 0.05},
+        {l3_current, DataType::int32, "L3 Current", "A", Scaling::thousand, Value::_int32_t(0), true, 0.05},
+        {l1_power_active, DataType::int32, "L1 Power (Active)", "W", Scaling::ten, Value::_int32_t(0), true, 5},
+        {l2_power_active, DataType::int32, "L2 Power (Active)", "W", Scaling::ten, Value::_int32_t(0), true, 5},
+        {l3_power_active, DataType::int32, "L3 Power (Active)", "W", Scaling::ten, Value::_int32_t(0), true, 5},
+        {l1_power_apparent, DataType::int32, "L1 Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0), true, 5},
+        {l2_power_apparent, DataType::int32, "L2 Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0), true, 5},
+        {l3_power_apparent, DataType::int32, "L3 Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0), true, 5},
+        {l1_power_reactive, DataType::int32, "L1 Power (Reactive)", "VAr", Scaling::ten, Value::_int32_t(0), true, 5},
+        {l2_power_reactive, DataType::int32, "L2 Power (Reactive)", "VAr", Scaling::ten, Value::_int32_t(0), true, 5},
+        {l3_power_reactive, DataType::int32, "L3 Power (Reactive)", "VAr", Scaling::ten, Value::_int32_t(0), true, 5},
+        {voltage_ln, DataType::int32, "L-N Voltage", "V", Scaling::ten, Value::_int32_t(0), true, 0.5},
+        {voltage_ll, DataType::int32, "L-L Voltage", "V", Scaling::ten, Value::_int32_t(0), true, 0.5},
+        {power_active, DataType::int32, "Total Power (Active)", "W", Scaling::ten, Value::_int32_t(0), true, 5},
+        {power_apparent, DataType::int32, "Total Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0), true, 5},
+        {power_reactive, DataType::int32, "Total Power (Reactive)", "VAr", Scaling::ten, Value::_int32_t(0), true, 5},
+        {l1_power_factor, DataType::int16, "L1 Power Factor", "", Scaling::thousand, Value::_int16_t(0), true, 0.01},
+        {l2_power_factor, DataType::int16, "L2 Power Factor", "", Scaling::thousand, Value::_int16_t(0), true, 0.01},
+        {l3_power_factor, DataType::int16, "L3 Power Factor", "", Scaling::thousand, Value::_int16_t(0), true, 0.01},
+        {total_pf, DataType::int16, "Total Power Factor", "", Scaling::thousand, Value::_int16_t(0), true, 0.01},
+        {phase_sequence, DataType::int16, "Phase Sequence", "", Scaling::none, Value::_int16_t(0), true},
+        {frequency, DataType::uint16, "Frequency", "Hz", Scaling::ten, Value::_uint16_t(0), true, 0.05},
+    };
+    inline constexpr RegisterDefinition<EM24_E1> EM24_E1::energy_registers[] = {
+        {import_energy_active, DataType::int32, "Imported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {import_energy_reactive, DataType::int32, "Imported Energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0), true},
+        {demand_power_active, DataType::int32, "Demand Power Active", "W", Scaling::ten, Value::_int32_t(0), true},
+        {maximum_demand_power_active, DataType::int32, "Maximum Demand Power Active", "W", Scaling::ten, Value::_int32_t(0), true},
+        {import_energy_active_partial, DataType::int32, "Partial imported Energy (Active))", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {import_energy_reactive_partial, DataType::int32, "Partial imported Energy (Reactive))", "Kvarh", Scaling::ten, Value::_int32_t(0), true},
+        {l1_import_energy_active, DataType::int32, "L1 Imported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {l2_import_energy_active, DataType::int32, "L2 Imported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {l3_import_energy_active, DataType::int32, "L3 Imported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {t1_import_energy, DataType::int32, "Tarif 1 imported energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {t2_import_energy, DataType::int32, "Tarif 2 imported energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {t3_import_energy, DataType::int32, "Tarif 3 imported energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {t4_import_energy, DataType::int32, "Tarif 4 imported energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {export_energy_active, DataType::int32, "Exported Energy (Active)", "kWh", Scaling::ten, Value::_int32_t(0), true},
+        {export_energy_reactive, DataType::int32, "Exported Energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0), true},
     };
+    inline constexpr RegisterDefinition<EM24_E1> EM24_E1::time_registers[] = {
+        {hour, DataType::int32, "Hour", "hour", Scaling::hundred, Value::_int32_t(0), true},
+    };
+    inline constexpr RegisterDefinition<EM24_E1> EM24_E1::tariff_registers[] = {
+        {t1_import_reactive, DataType::int32, "Tarif 1 imported energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0), true},
+        {t2_import_reactive, DataType::int32, "Tarif 2 imported energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0), true},
+        {t3_import_reactive, DataType::int32, "Tarif 3 imported energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0), true},
+        {t4_import_reactive, DataType::int32, "Tarif 4 imported energy (Reactive)", "Kvarh", Scaling::ten, Value::_int32_t(0), true},
+        {demand_power_apparent, DataType::int32, "Demand Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0), true},
+        {maximum_demand_power_apparent, DataType::int32, "Maximum Demand Power (Apparent)", "VA", Scaling::ten, Value::_int32_t(0), true},
+        {maximum_demand_current, DataType::int32, "Maximum Demand current (Active)", "A", Scaling::thousand, Value::_int32_t(0), true},
+    };
+    inline constexpr BlockDefinition<EM24_E1> EM24_E1::blocks[] = {
+        // Instantaneous values, update regularly
+        {"dynamic", 0x0000, dynamic_registers, 300, 0, 1000, 300, 100},
+        {"energy", 0x0034, energy_registers, 2000, 1, 10000, 2000, 500},
+        // These hardly ever change
+        {"time", 0x005a, time_registers, 10000, 2, 60000, 10000, 5000},
+        {"tariff", 0x006e, tariff_registers, 10000, 2, 60000, 10000, 5000},
+    };
+    inline constexpr DeviceTable<EM24_E1, std::size(EM24_E1::blocks), countRegisters(EM24_E1::blocks)> em24_e1_table("em24_e1", EM24_E1::blocks);
+    static_assert(em24_e1_table.complete(), "Every EM24_E1 register must be defined exactly once");
+    static_assert(em24_e1_table.ordered(), "EM24_E1 blocks must be sorted by offset and may not overlap");
 
+    constexpr const DeviceDescription<EM24_E1> &EM24_E1::getDeviceDescription()
+    {
+        return em24_e1_table.description();
+    }
 }
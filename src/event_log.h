@@ -0,0 +1,191 @@
+/**
+ * @file      event_log.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Log of binary event records, formatted as text only when the log is shown
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <mutex>
+#include <vector>
+#include <time.h>
+#include "ModbusError.h"
+
+// Number of records per log, can be set as build flag. Records are kept in PSRAM when the board has it.
+#ifndef LOG_CAPACITY
+#define LOG_CAPACITY 200
+#endif
+
+namespace modbus_gateway
+{
+    enum Event : uint16_t
+    {
+        server_read,
+        server_range_error,
+        server_write,
+        server_write_register,
+        server_written,
+        client_pool_exhausted,
+        client_request_error,
+        client_error_response,
+        client_size_mismatch,
+        last_event
+    };
+
+    // Ring of fixed size records: the millis() timestamp, the event and its arguments. Adding a record
+    // takes a short lock and never formats. The records are allocated by the first add(): logs are
+    // static objects, constructed before setup() and so possibly before PSRAM is initialized.
+    class Log
+    {
+    public:
+        Log(uint16_t capacity = LOG_CAPACITY) : _records(nullptr), _capacity(capacity), _current(0), _count(0), _heap(nullptr)
+        {
+        }
+        ~Log()
+        {
+            free(_records);
+        }
+        Log(const Log &) = delete;
+        Log &operator=(const Log &) = delete;
+
+        void add(Event e, int32_t a0 = 0, int32_t a1 = 0, int32_t a2 = 0, int32_t a3 = 0, int32_t a4 = 0)
+        {
+            uint32_t now = millis();
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_heap == nullptr)
+                allocate();
+            if (_capacity == 0)
+                return;
+            _records[_current] = Record{now, e, {a0, a1, a2, a3, a4}};
+            if (++_current >= _capacity)
+                _current = 0;
+            if (_count < _capacity)
+                _count++;
+        }
+
+        // Newest first. Timestamps are shown as local time once the clock is set, as uptime before.
+        String allValuesAsString() const
+        {
+            // The records are copied under one lock, so a concurrent add() can't mix into the listing.
+            // The copy is allocated before, adding a record never waits for the heap.
+            std::unique_lock<std::mutex> lock(_mutex);
+            uint16_t capacity = _capacity;
+            lock.unlock();
+            std::vector<Record> records(capacity);
+            lock.lock();
+            uint16_t count = std::min(_count, capacity);
+            for (uint16_t i = 0; i < count; i++)
+            {
+                int32_t c = int32_t(_current) - i - 1;
+                if (c < 0)
+                    c += _capacity;
+                records[i] = _records[c];
+            }
+            const char *heap = _heap;
+            capacity = _capacity;
+            lock.unlock();
+
+            uint32_t now = millis();
+            time_t wall = time(nullptr);
+            bool synced = wall > 1600000000;
+            String r;
+            char buf[200];
+            snprintf(buf, sizeof(buf), "Log: %u of %u records in %s\r\n", count, capacity, heap == nullptr ? "no memory yet" : heap);
+            r += buf;
+            for (uint16_t i = 0; i < count; i++)
+            {
+                const Record &rec = records[i];
+                uint16_t n = 0;
+                if (synced)
+                {
+                    time_t t = wall - (now - rec._time) / 1000;
+                    struct tm timeinfo;
+                    localtime_r(&t, &timeinfo);
+                    n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S: ", &timeinfo);
+                }
+                else
+                    n = snprintf(buf, sizeof(buf), "+%u.%03us: ", rec._time / 1000, rec._time % 1000);
+                format(rec, buf + n, sizeof(buf) - n);
+                r += buf;
+                r += "\r\n";
+            }
+            return r;
+        }
+
+    private:
+        struct Record
+        {
+            uint32_t _time;
+            Event _event;
+            int32_t _args[5];
+        };
+
+        // Called with the lock held
+        void allocate()
+        {
+#ifdef BOARD_HAS_PSRAM
+            _records = static_cast<Record *>(ps_malloc(sizeof(Record) * _capacity));
+            _heap = "PSRAM";
+#endif
+            if (_records == nullptr)
+            {
+                _records = static_cast<Record *>(malloc(sizeof(Record) * _capacity));
+                _heap = "internal RAM";
+            }
+            if (_records == nullptr)
+            {
+                _capacity = 0;
+                _heap = "no memory";
+            }
+        }
+
+        static void format(const Record &rec, char *buf, size_t size)
+        {
+            const int32_t *a = rec._args;
+            switch (rec._event)
+            {
+            case server_read:
+                snprintf(buf, size, "Response: serverID=%d, FC=%d, start=%d length=%d%s", a[0], a[1], a[2], a[3], a[4] ? " cached" : "");
+                break;
+            case server_range_error:
+                snprintf(buf, size, "Error: serverID=%d, FC=%d, start=%d length=%d", a[0], a[1], a[2], a[3]);
+                break;
+            case server_write:
+                snprintf(buf, size, "Writing: serverID=%d, FC=%d, start=%d, length=%d, size=%d", a[0], a[1], a[2], a[3], a[4]);
+                break;
+            case server_write_register:
+                snprintf(buf, size, "Register %d=%04x", a[0], a[1]);
+                break;
+            case server_written:
+                snprintf(buf, size, "Written: serverID=%d, FC=%d, start=%d length=%d", a[0], a[1], a[2], a[3]);
+                break;
+            case client_pool_exhausted:
+                snprintf(buf, size, "Request pool exhausted, offset=%d, nbr_reg=%d, %d", a[0], a[1], a[2]);
+                break;
+            case client_request_error:
+                snprintf(buf, size, "Error creating request: %02X - %s, offset=%d, nbr_reg=%d, %d", a[0], (const char *)ModbusError(Error(a[0])), a[1], a[2], a[3]);
+                break;
+            case client_error_response:
+                snprintf(buf, size, "Error response: %02X - %s - offset=%d, nbr_reg=%d - %d - %d", a[0], (const char *)ModbusError(Error(a[0])), a[1], a[2], a[3], a[4]);
+                break;
+            case client_size_mismatch:
+                snprintf(buf, size, "Expected bytes: %d, received bytes: %d", a[0], a[1]);
+                break;
+            default:
+                snprintf(buf, size, "Event %u: %d %d %d %d %d", rec._event, a[0], a[1], a[2], a[3], a[4]);
+                break;
+            }
+        }
+
+        Record *_records;
+        uint16_t _capacity;
+        uint16_t _current;
+        uint16_t _count;
+        // Where the records are, nullptr until the first add()
+        const char *_heap;
+        mutable std::mutex _mutex;
+    };
+}
@@ -0,0 +1,236 @@
+/**
+ * @file      event_push.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Push changed register values to browsers as Server-Sent Events
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <lwip/sockets.h>
+#include <errno.h>
+#include <math.h>
+#include "definitions.h"
+
+namespace modbus_gateway
+{
+    // Keeps up to CLIENTS event streams open. update() compares new values with the values pushed before
+    // and queues one message with the registers that moved more than their deadband:
+    //   event: values
+    //   data: {"<offset>":<value>,..}
+    // poll() sends what is queued without blocking. Every client has a buffer of BUFFER bytes; a message
+    // that doesn't fit is dropped for that client, which then gets all values once its buffer is empty.
+    template <typename MODBUS_TYPE, uint16_t CLIENTS = 4, size_t BUFFER = 2048>
+    class EventPush
+    {
+    public:
+        using Values = typename Device<MODBUS_TYPE>::Values;
+
+        EventPush(const Device<MODBUS_TYPE> &device) : _device(device), _messages(0), _keepalive(0)
+        {
+            for (auto b = _device._dd._bds.begin(); b < _device._dd._bds.end(); b++)
+                _sent.resize(_sent.size() + b->_rds.size(), NAN);
+        }
+
+        // Take over the connection of an HTTP request. Returns false when all places are taken.
+        bool subscribe(WiFiClient client)
+        {
+            for (auto s = _subscribers; s < _subscribers + CLIENTS; s++)
+            {
+                if (s->_used)
+                    continue;
+                // The copy shares the socket with the web server, which keeps it open after the handler returns
+                s->_client = client;
+                s->_client.setNoDelay(true);
+                s->_used = true;
+                s->_start = 0;
+                s->_length = 0;
+                s->_resync = true;
+                const char *header = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\n"
+                                     "Connection: keep-alive\r\nAccess-Control-Allow-Origin: *\r\n\r\n";
+                queue(*s, header, strlen(header));
+                return true;
+            }
+            return false;
+        }
+
+        bool subscribed() const
+        {
+            for (auto s = _subscribers; s < _subscribers + CLIENTS; s++)
+            {
+                if (s->_used)
+                    return true;
+            }
+            return false;
+        }
+
+        // Queue the changed values for every client
+        void update(const Values &v)
+        {
+            size_t length = message(v, false);
+            if (length == 0)
+                return;
+            _messages++;
+            for (auto s = _subscribers; s < _subscribers + CLIENTS; s++)
+            {
+                if (s->_used && !s->_resync && !queue(*s, _message, length))
+                {
+                    s->_dropped++;
+                    s->_resync = true;
+                }
+            }
+        }
+
+        // Send queued data, as far as the sockets take it without waiting. Clients that start over get
+        // all values once their buffer is empty; v are the latest values.
+        void poll(const Values &v, uint32_t now)
+        {
+            bool keepalive = now - _keepalive >= 15000;
+            if (keepalive)
+                _keepalive = now;
+            for (auto s = _subscribers; s < _subscribers + CLIENTS; s++)
+            {
+                if (!s->_used)
+                    continue;
+                if (keepalive)
+                    queue(*s, ":\n\n", 3);
+                if (!send(*s))
+                    continue;
+                if (s->_resync && s->_length == 0 && !v._image.empty())
+                {
+                    size_t length = message(v, true);
+                    if (queue(*s, _message, length))
+                        s->_resync = false;
+                }
+            }
+        }
+
+        String allValuesAsString() const
+        {
+            String r;
+            char buf[100];
+            sprintf(buf, "Event push: messages=%u\r\n", _messages);
+            r += buf;
+            for (auto s = _subscribers; s < _subscribers + CLIENTS; s++)
+            {
+                if (!s->_used)
+                    continue;
+                sprintf(buf, "  client %u: queued=%u, dropped=%u\r\n", unsigned(s - _subscribers), unsigned(s->_length), s->_dropped);
+                r += buf;
+            }
+            return r;
+        }
+
+    private:
+        struct Subscriber
+        {
+            WiFiClient _client;
+            bool _used = false;
+            bool _resync = false;
+            char _buffer[BUFFER];
+            size_t _start = 0;
+            size_t _length = 0;
+            uint32_t _dropped = 0;
+        };
+
+        // Build the message in _message. all: every register, otherwise only the ones outside their deadband.
+        // Returns the length, 0 when nothing changed.
+        size_t message(const Values &v, bool all)
+        {
+            const char *head = "event: values\ndata: {";
+            size_t length = strlen(head);
+            memcpy(_message, head, length);
+            bool changed = false;
+            size_t index = 0;
+            for (size_t b = 0; b < _device._dd._bds.size(); b++)
+            {
+                const BlockDescription &bd = _device._dd._bds[b];
+                const uint16_t *registers = _device.blockRegisters(v, b);
+                const float *values = _device.blockValues(v, b);
+                for (auto i = bd._rds.begin(); i < bd._rds.end(); i++, index++)
+                {
+                    const uint16_t *r = &registers[i->_offset - bd._offset];
+                    float f = values[i - bd._rds.begin()];
+                    float &sent = _sent[index];
+                    bool moved = isnan(f) != isnan(sent) || fabsf(f - sent) > i->_deadband || (i->_deadband == 0 && !isnan(f) && f != sent);
+                    if (!all && !moved)
+                        continue;
+                    char value[40];
+                    i->format(r, value);
+                    bool number = isdigit(value[0]) || (value[0] == '-' && isdigit(value[1]));
+                    char item[64];
+                    int n = snprintf(item, sizeof(item), "%s\"%u\":%s", changed ? "," : "", i->_offset, number ? value : "null");
+                    // What doesn't fit stays unsent and goes with the next message
+                    if (length + n + 4 > sizeof(_message))
+                        continue;
+                    memcpy(_message + length, item, n);
+                    length += n;
+                    changed = true;
+                    if (moved)
+                        sent = f;
+                }
+            }
+            if (!changed)
+                return 0;
+            memcpy(_message + length, "}\n\n", 3);
+            return length + 3;
+        }
+
+        bool queue(Subscriber &s, const char *data, size_t length)
+        {
+            if (s._length + length > BUFFER)
+                return false;
+            if (s._start + s._length + length > BUFFER)
+            {
+                memmove(s._buffer, s._buffer + s._start, s._length);
+                s._start = 0;
+            }
+            memcpy(s._buffer + s._start + s._length, data, length);
+            s._length += length;
+            return true;
+        }
+
+        // Returns false when the client is gone
+        bool send(Subscriber &s)
+        {
+            if (!s._client.connected())
+            {
+                close(s);
+                return false;
+            }
+            while (s._length > 0)
+            {
+                int n = ::send(s._client.fd(), s._buffer + s._start, s._length, MSG_DONTWAIT);
+                if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))
+                    break;
+                if (n <= 0)
+                {
+                    close(s);
+                    return false;
+                }
+                s._start += n;
+                s._length -= n;
+            }
+            if (s._length == 0)
+                s._start = 0;
+            return true;
+        }
+
+        void close(Subscriber &s)
+        {
+            s._client.stop();
+            s._client = WiFiClient();
+            s._used = false;
+        }
+
+        const Device<MODBUS_TYPE> &_device;
+        Subscriber _subscribers[CLIENTS];
+        std::vector<float> _sent;
+        char _message[BUFFER];
+        uint32_t _messages;
+        uint32_t _keepalive;
+    };
+}
@@ -23,6 +23,13 @@
 #include "em24_e1.h"
 #include "wattnode.h"
 #include "convert_em24_e1_to_wattnode.h"
+#include "chunked_response.h"
+#include "snapshot_api.h"
+#include "event_push.h"
+#include "tasks.h"
+#include "tcp_front_end.h"
+#include "proxy.h"
+#include "poll_controller.h"
 #include "ModbusClientTCP.h"
 #include "ModbusServerRTU.h"
 #include "RTUutils.h"
@@ -33,8 +40,6 @@
 static bool eth_connected = false;
 WebServer server(80);
 
-WiFiClient theClient;
-
 // NTP Server
 const char *ntpServer = "pool.ntp.org";
 const long gmtOffset_sec = 3600;
@@ -51,20 +56,98 @@ const int daylightOffset_sec = 3600;
 // TCP Master REMOTE ip address & RTU Slave SLAVE_ID are coming from secrets.ini
 // #define REMOTE "192.168.1.2"
 // #define SLAVE_ID 2
+// With more than one EM24, REMOTES lists their addresses and their values are combined
+// #define REMOTES "192.168.1.2", "192.168.1.3"
+// Other masters read the meters through the proxy at EM24_PROXY_PORT, the next meter at the next port
+// #define EM24_PROXY_PORT 5020
+// Connections to every meter, a slow response on one doesn't hold up the reads on the others
+// #define EM24_CONNECTIONS 2
+// Requests outstanding over all meters and connections, at least meters * EM24_CONNECTIONS * 10
+// #define CLIENT_REQUESTS 64
+#ifndef REMOTES
+#define REMOTES REMOTE
+#endif
+#ifndef EM24_CONNECTIONS
+#define EM24_CONNECTIONS 1
+#endif
 
-// TCP Master
-IPAddress remote()
+// TCP Masters: every meter has its own connections, client and poll schedule, so the meters are read
+// in parallel
+struct Meter
+{
+    struct Connection
+    {
+        Connection() : _tcp(_connection, modbus_gateway::Client<modbus_gateway::EM24_E1>::queue_limit) {}
+        WiFiClient _connection;
+        ModbusClientTCP _tcp;
+    };
+
+    Meter(const char *address) : _client(_connections[0]._tcp, ip(address), TCP_PORT, TCP_SERVER_ID), _scheduler(10)
+    {
+        for (size_t i = 1; i < EM24_CONNECTIONS; i++)
+            _client.addConnection(_connections[i]._tcp);
+    }
+    static IPAddress ip(const char *address)
+    {
+        IPAddress a;
+        a.fromString(address);
+        return a;
+    }
+    Connection _connections[EM24_CONNECTIONS];
+    modbus_gateway::Client<modbus_gateway::EM24_E1> _client;
+    // Polls the meter blocks as declared in em24_e1.h, within the queue of the tcp client
+    modbus_gateway::PollScheduler _scheduler;
+    // Slows the polls down when the meter can't keep up and speeds them up again when it can
+    modbus_gateway::PollController _controller{_scheduler};
+#ifdef EM24_PROXY_PORT
+    modbus_gateway::Proxy<modbus_gateway::EM24_E1> _proxy{_client};
+    modbus_gateway::TcpFrontEnd<modbus_gateway::Proxy<modbus_gateway::EM24_E1>, 4> _proxyFrontEnd{_proxy, modbus_gateway::TcpLimits()};
+#endif
+};
+Meter meters[] = {REMOTES};
+// The meters share the request pool of their client type, which must hold the full queue of every
+// connection
+static_assert(std::size(meters) * EM24_CONNECTIONS * modbus_gateway::Client<modbus_gateway::EM24_E1>::queue_limit <=
+                  modbus_gateway::Client<modbus_gateway::EM24_E1>::max_requests,
+              "Raise CLIENT_REQUESTS to the number of meters * EM24_CONNECTIONS * Client::queue_limit");
+
+// How the values of the meters are combined, registers that are not listed are summed
+modbus_gateway::ArrayView<modbus_gateway::Aggregate<modbus_gateway::EM24_E1>::Rule> aggregateRules()
 {
-    IPAddress a;
-    a.fromString(REMOTE);
-    return a;
+    using modbus_gateway::EM24_E1;
+    using A = modbus_gateway::Aggregate<EM24_E1>;
+    static constexpr A::Rule rules[] = {
+        {EM24_E1::l1_voltage, A::average},
+        {EM24_E1::l2_voltage, A::average},
+        {EM24_E1::l3_voltage, A::average},
+        {EM24_E1::l12_voltage, A::average},
+        {EM24_E1::l23_voltage, A::average},
+        {EM24_E1::l31_voltage, A::average},
+        {EM24_E1::voltage_ln, A::average},
+        {EM24_E1::voltage_ll, A::average},
+        {EM24_E1::l1_power_factor, A::average},
+        {EM24_E1::l2_power_factor, A::average},
+        {EM24_E1::l3_power_factor, A::average},
+        {EM24_E1::total_pf, A::average},
+        {EM24_E1::frequency, A::average},
+        {EM24_E1::phase_sequence, A::maximum},
+        {EM24_E1::hour, A::maximum},
+    };
+    return rules;
 }
-ModbusClientTCP tcp(theClient, 10);
-modbus_gateway::Client<modbus_gateway::EM24_E1> meter(tcp, remote(), TCP_PORT, TCP_SERVER_ID);
+// The combined meter, which is what the converter and the web pages see
+modbus_gateway::Aggregate<modbus_gateway::EM24_E1> meter(aggregateRules());
 
-// TCP Slave
+// RTU Slaves, more servers can attach to the bus with their own ID
 ModbusServerRTU rtu(1000);
-modbus_gateway::Server<modbus_gateway::WattNode> wattnode(rtu, RTU_SERVER_ID, SERIAL_NUMBER);
+modbus_gateway::Bus bus(rtu);
+modbus_gateway::Server<modbus_gateway::WattNode> wattnode(bus, RTU_SERVER_ID, SERIAL_NUMBER);
+
+// Optional Modbus TCP access to the slaves on the bus, for home automation and loggers
+#ifdef MODBUS_TCP_PORT
+modbus_gateway::BusReader busReader(bus);
+modbus_gateway::TcpFrontEnd<modbus_gateway::BusReader, 8> tcpFrontEnd(busReader, modbus_gateway::TcpLimits());
+#endif
 
 // Converter mapping
 modbus_gateway::ConvertEM24_E1ToWattNode converter(meter, wattnode);
@@ -74,10 +157,110 @@ modbus_gateway::ConvertEM24_E1ToWattNode converter(meter, wattnode);
 #define BOARD_485_RX 32
 #define Serial485 Serial2
 
-// Room for 3 timed events
-unsigned long prevTime1;
-unsigned long prevTime2;
-unsigned long prevTime3;
+// Registers the converter doesn't use are not read. Used registers at most READ_GAP registers apart
+// are read in one request.
+#ifndef READ_GAP
+#define READ_GAP 8
+#endif
+// Meter reads follow the rhythm of the inverter requests, this many ms on top of the round trip
+// before the inverter is expected
+#ifndef PREFETCH_MARGIN
+#define PREFETCH_MARGIN 30
+#endif
+uint32_t cadenceVersion = 0;
+
+// Changed meter values are pushed to the clients of /events
+modbus_gateway::EventPush<modbus_gateway::EM24_E1> push(meter._device);
+modbus_gateway::Device<modbus_gateway::EM24_E1>::Values pushValues;
+std::atomic<bool> pushPending{false};
+
+// Polls the meters. Wakes when a poll is due or a response freed a place in a client queue, and at
+// least every POLL_INTERVAL ms to follow changes in the inverter cadence.
+#ifndef POLL_INTERVAL
+#define POLL_INTERVAL 50
+#endif
+uint32_t pollMeter()
+{
+    // Time the meter reads so fresh values are stored just before the inverter asks for them
+    if (wattnode.cadenceVersion() != cadenceVersion)
+    {
+        cadenceVersion = wattnode.cadenceVersion();
+        uint32_t now = millis();
+        wattnode.predictions(now, [&](uint16_t address, uint16_t words, uint32_t next)
+                             {
+            uint32_t blocks = converter.sourceBlocks(address, words);
+            for (Meter &m : meters)
+            {
+                uint32_t lead = m._client.roundTrip() + PREFETCH_MARGIN;
+                for (uint32_t b = 0; b < meter._device._dd._bds.size(); b++)
+                {
+                    if (blocks & (1u << b))
+                        m._scheduler.align(meter._device._dd._bds[b]._name, next - lead, now);
+                }
+            } });
+    }
+
+    // Send the reads that are due
+    uint32_t wait = POLL_INTERVAL;
+    for (Meter &m : meters)
+    {
+        m._controller.update(millis(), m._client.pendingRequests(), m._client.requests(), m._client.errors(), m._client.roundTrip());
+        m._scheduler.run(millis(), m._client.pendingRequests(), [&](const modbus_gateway::ReadPlan &p)
+                         { return m._client.read(p); });
+        // A job that is still due waits for room in the queue
+        uint32_t next = m._scheduler.next(millis());
+        wait = std::min<uint32_t>(wait, next == 0 ? 5 : next);
+    }
+    return wait;
+}
+
+// Combines the meters and converts the result to the wattnode object, woken by every meter response
+uint32_t convert()
+{
+    meter.update(millis());
+    converter.CopyDataFromMasterToSlave();
+    pushPending = true;
+    return modbus_gateway::Task::forever;
+}
+
+// OTA, HTTP requests and the event streams. The web server can't signal new connections, so it is polled.
+uint32_t serveWeb()
+{
+    ArduinoOTA.handle();
+    server.handleClient();
+    if (pushPending.exchange(false) && push.subscribed())
+    {
+        {
+            modbus_gateway::DataAccess<modbus_gateway::Aggregate<modbus_gateway::EM24_E1>> m(meter);
+            m.copyValues(pushValues);
+        }
+        push.update(pushValues);
+    }
+    push.poll(pushValues, millis());
+    return 2;
+}
+
+// Polling and conversion share the application core, polling first; the web side runs next to the
+// network stack on the other core, so a slow HTTP client doesn't delay the meter.
+modbus_gateway::Task pollTask("poll", 4096, 3, 1, pollMeter);
+modbus_gateway::Task convertTask("convert", 4096, 2, 1, convert);
+modbus_gateway::Task webTask("web", 8192, 1, 0, serveWeb);
+#if defined(MODBUS_TCP_PORT) || defined(EM24_PROXY_PORT)
+// Serves the Modbus TCP connections
+uint32_t serveTcp()
+{
+    uint32_t now = millis();
+#ifdef MODBUS_TCP_PORT
+    tcpFrontEnd.poll(now);
+#endif
+#ifdef EM24_PROXY_PORT
+    for (Meter &m : meters)
+        m._proxyFrontEnd.poll(now);
+#endif
+    return 2;
+}
+modbus_gateway::Task tcpTask("tcp", 4096, 1, 0, serveTcp);
+#endif
 
 void handleRoot()
 {
@@ -96,45 +279,159 @@ void handleInfo()
 {
     String r = "ESP-IDF version is: " + String(esp_get_idf_version()) + "\r\n";
     r += String("FlashSize = ") + String(ESP.getFlashChipSize()) + " bytes\r\n";
+    {
+        using modbus_gateway::EM24_E1;
+        char buf[200];
+        modbus_gateway::DataAccess<modbus_gateway::Aggregate<EM24_E1>> m(meter);
+        sprintf(buf, "Meter: %.1f W, %.1f V, %.2f Hz\r\n", m.get<EM24_E1::power_active>(), m.get<EM24_E1::voltage_ln>(), m.get<EM24_E1::frequency>());
+        r += buf;
+    }
+    r += bus.allValuesAsString();
+    r += wattnode.cacheAsString();
+    r += converter.statsAsString();
+    r += modbus_gateway::Client<modbus_gateway::EM24_E1>::requestPoolAsString();
+    r += meter.allValuesAsString(millis());
+    for (Meter &m : meters)
+    {
+        r += m._client.connectionsAsString();
+        r += m._controller.allValuesAsString();
+        r += m._scheduler.allValuesAsString(millis());
+    }
+    r += wattnode.timingAsString();
+    r += push.allValuesAsString();
+#ifdef MODBUS_TCP_PORT
+    r += tcpFrontEnd.allValuesAsString();
+#endif
+#ifdef EM24_PROXY_PORT
+    for (Meter &m : meters)
+    {
+        r += m._proxyFrontEnd.allValuesAsString();
+        r += m._proxy.allValuesAsString();
+    }
+#endif
+    r += modbus_gateway::Task::allValuesAsString();
 
     server.send(200, "text/plain", r.c_str());
 }
 
+// The values are copied with the device locked and formatted while streaming the response.
+// The copies are kept, so after the first request no memory is allocated.
 void handleMeter()
 {
-    modbus_gateway::DataAccess<modbus_gateway::Client<modbus_gateway::EM24_E1>> m(meter);
-    String r = m.allValuesAsString();
-    server.send(200, "text/plain", r.c_str());
+    static modbus_gateway::Device<modbus_gateway::EM24_E1>::Values values;
+    {
+        modbus_gateway::DataAccess<modbus_gateway::Aggregate<modbus_gateway::EM24_E1>> m(meter);
+        m.copyValues(values);
+    }
+    modbus_gateway::ChunkedResponse r(server, 200, "text/plain");
+    meter._device.formatValues(values, [&](const char *s)
+                               { r.write(s); });
+    // The meters themselves, when there is more than one
+    if (std::size(meters) == 1)
+        return;
+    for (Meter &m : meters)
+    {
+        {
+            modbus_gateway::DataAccess<modbus_gateway::Client<modbus_gateway::EM24_E1>> c(m._client);
+            c.copyValues(values);
+        }
+        r.write("\r\n");
+        m._client._device.formatValues(values, [&](const char *s)
+                                       { r.write(s); });
+    }
+}
+
+// The connection stays open and is served from loop()
+void handleEvents()
+{
+    if (!push.subscribe(server.client()))
+        server.send(503, "text/plain", "Too many event clients");
 }
 
 void handleWattnode()
 {
-    modbus_gateway::DataAccess<modbus_gateway::Server<modbus_gateway::WattNode>> wn(wattnode);
-    String r = wn.allValuesAsString();
-    server.send(200, "text/plain", r.c_str());
+    static modbus_gateway::Device<modbus_gateway::WattNode>::Values values;
+    {
+        modbus_gateway::DataAccess<modbus_gateway::Server<modbus_gateway::WattNode>> wn(wattnode);
+        wn.copyValues(values);
+    }
+    modbus_gateway::ChunkedResponse r(server, 200, "text/plain");
+    wattnode._device.formatValues(values, [&](const char *s)
+                                  { r.write(s); });
+}
+
+// Both devices as JSON, or as CBOR with ?format=cbor. The ETag follows the block generations of the
+// meter and the published version of the wattnode, so an unchanged snapshot is answered with 304.
+void handleSnapshot()
+{
+    static modbus_gateway::Device<modbus_gateway::EM24_E1>::Values meterValues;
+    static modbus_gateway::Device<modbus_gateway::WattNode>::Values wattnodeValues;
+
+    uint32_t hash = 2166136261u; // FNV-1a
+    {
+        modbus_gateway::DataAccess<modbus_gateway::Aggregate<modbus_gateway::EM24_E1>> m(meter);
+        for (uint32_t b = 0; b < meter._device._dd._bds.size(); b++)
+            hash = (hash ^ m.generation(b)) * 16777619u;
+    }
+    char etag[24];
+    sprintf(etag, "\"%08x-%08x\"", hash, wattnode.version());
+    server.sendHeader("ETag", etag);
+    server.sendHeader("Cache-Control", "no-cache");
+    if (server.header("If-None-Match") == etag)
+    {
+        server.send(304);
+        return;
+    }
+
+    {
+        modbus_gateway::DataAccess<modbus_gateway::Aggregate<modbus_gateway::EM24_E1>> m(meter);
+        m.copyValues(meterValues);
+    }
+    {
+        modbus_gateway::DataAccess<modbus_gateway::Server<modbus_gateway::WattNode>> wn(wattnode);
+        wn.copyValues(wattnodeValues);
+    }
+    bool cbor = server.arg("format") == "cbor";
+    modbus_gateway::ChunkedResponse r(server, 200, cbor ? "application/cbor" : "application/json");
+    auto out = [&](const char *s, size_t n)
+    { r.write(s, n); };
+    if (cbor)
+    {
+        // Map of the two devices
+        r.write("\xa2\x65meter", 7);
+        modbus_gateway::writeCbor(meter._device, meterValues, out);
+        r.write("\x68wattnode", 9);
+        modbus_gateway::writeCbor(wattnode._device, wattnodeValues, out);
+    }
+    else
+    {
+        r.write("{\"meter\":");
+        modbus_gateway::writeJson(meter._device, meterValues, out);
+        r.write(",\"wattnode\":");
+        modbus_gateway::writeJson(wattnode._device, wattnodeValues, out);
+        r.write("}");
+    }
 }
 
+// The descriptions never change, they are formatted once in setup()
+String descriptions;
+
 void handleDescription()
 {
-    String r;
-    r += wattnode._device._dd.GetDescriptions();
-    r += meter._device._dd.GetDescriptions();
-    server.send(200, "text/plain", r.c_str());
+    server.send(200, "text/plain", descriptions);
 }
 
 void handleLogMeter()
 {
-    modbus_gateway::DataAccess<modbus_gateway::Client<modbus_gateway::EM24_E1>> m(meter);
-
-    String r = m.getLog();
+    String r;
+    for (Meter &m : meters)
+        r += m._client.logAsString();
     server.send(200, "text/plain", r.c_str());
 }
 
 void handleLogWattnode()
 {
-    modbus_gateway::DataAccess<modbus_gateway::Server<modbus_gateway::WattNode>> wn(wattnode);
-
-    String r = wn.getLog();
+    String r = wattnode.logAsString();
     server.send(200, "text/plain", r.c_str());
 }
 
@@ -229,23 +526,37 @@ void setup()
     server.on("/", handleRoot);
     server.on("/info", handleInfo);
     server.on("/description", handleDescription);
+    server.on("/api/snapshot", handleSnapshot);
     server.on("/meter", handleMeter);
     server.on("/wattnode", handleWattnode);
+    server.on("/events", handleEvents);
     server.on("/logmeter", handleLogMeter);
     server.on("/logwattnode", handleLogWattnode);
     server.onNotFound(handleNotFound);
 
+    // Needed for the ETag of /api/snapshot
+    const char *headers[] = {"If-None-Match"};
+    server.collectHeaders(headers, 1);
     server.begin();
+#ifdef MODBUS_TCP_PORT
+    tcpFrontEnd.begin(MODBUS_TCP_PORT);
+#endif
+#ifdef EM24_PROXY_PORT
+    for (size_t i = 0; i < std::size(meters); i++)
+        meters[i]._proxyFrontEnd.begin(EM24_PROXY_PORT + i);
+#endif
     Serial.println("HTTP server started");
 
-    tcp.setTimeout(2000, 200);
-    tcp.begin();
-    tcp.setTarget(IPAddress(remote()), 502);
+    for (Meter &m : meters)
+        m._client.connect();
 
-    // Setup timers to allow tracking elapsed time
-    prevTime1 = millis() - 10000; // trigger timers immediately at startup
-    prevTime2 = prevTime1;
-    prevTime3 = prevTime1;
+    // Poll the registers the converter uses, all blocks are due immediately
+    for (Meter &m : meters)
+    {
+        m._client.schedule(m._scheduler, converter.sourceRegisters(), READ_GAP, millis());
+        meter.add(m._client);
+    }
+    Serial.print(meters[0]._scheduler.allValuesAsString(millis()));
 
     // Start the 485 serial bus
     RTUutils::prepareHardwareSerial(Serial485);
@@ -253,8 +564,9 @@ void setup()
     rtu.begin(Serial485);
 
     // Print the setup of the modbus devices
-    Serial.print(wattnode._device._dd.GetDescriptions());
-    Serial.print(meter._device._dd.GetDescriptions());
+    descriptions = wattnode._device._dd.GetDescriptions();
+    descriptions += meter._device._dd.GetDescriptions();
+    Serial.print(descriptions);
 
     // OTA
     ArduinoOTA.setHostname(DEVICENAME);
@@ -286,47 +598,22 @@ void setup()
     Serial.print("FlashSize = ");
     Serial.print(ESP.getFlashChipSize());
     Serial.println("bytes.");
+
+    for (Meter &m : meters)
+        m._client.onData([]()
+                         {
+            convertTask.notify();
+            pollTask.notify(); });
+    convertTask.start();
+    pollTask.start();
+    webTask.start();
+#if defined(MODBUS_TCP_PORT) || defined(EM24_PROXY_PORT)
+    tcpTask.start();
+#endif
 }
 
 void loop()
 {
-    // check for updates
-    ArduinoOTA.handle();
-
-    // Handle HTTP requests
-    server.handleClient();
-
-    // use elapsed time to know when to add a new job
-    unsigned long currTime = millis();
-    bool jobScheduled = false;
-    if (currTime - prevTime1 >= 300) // Instantaneous variables, update regularly
-    {
-        meter.readBlockFromMeter("dynamic");
-        prevTime1 = currTime;
-        jobScheduled = true;
-    }
-    if (currTime - prevTime2 >= 2000) // Updated every two seconds
-    {
-        meter.readBlockFromMeter("energy");
-        prevTime2 = currTime;
-        jobScheduled = true;
-    }
-    if (currTime - prevTime3 >= 10000) // This hardly ever changes
-    {
-
-        meter.readBlockFromMeter("time");
-        meter.readBlockFromMeter("tariff");
-        prevTime3 = currTime;
-        jobScheduled = true;
-    }
-
-    // Received data from the meter and it is now stored in the meter object
-    // Copy and convert this data to the wattnode object
-    if (meter._dataRead)
-    {
-        converter.CopyDataFromMasterToSlave();
-        meter._dataRead = false;
-    }
-    if (jobScheduled)
-        delay(100);
-}
\ No newline at end of file
+    // All work is done in the tasks started in setup()
+    vTaskDelete(nullptr);
+}
@@ -0,0 +1,105 @@
+/**
+ * @file      poll_controller.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Adapts the poll periods to what the meter can answer
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "poll_scheduler.h"
+
+namespace modbus_gateway
+{
+    // What the meter should be kept at. The mean number of requests waiting in the client queue is
+    // measured over every interval ms. The fraction of requests that fail or time out is measured over
+    // at least min_requests requests, which may take several intervals: over a dozen requests a single
+    // failure would be far over the target. More failures than the target allows over min_requests are
+    // judged at once.
+    struct PollTargets
+    {
+        float _depth = 2;
+        float _errors = 0.02;
+        uint32_t _interval = 1000;
+        uint32_t _min_requests = 50;
+    };
+
+    // Measures the load on a meter and adapts the periods of a PollScheduler to it, like TCP does its
+    // congestion window: when the queue is deeper than the target or too many requests fail all periods
+    // double, otherwise the poll rates grow a bit every interval. The periods stay between the minimum
+    // period and the maximum staleness of their block.
+    class PollController
+    {
+    public:
+        PollController(PollScheduler &scheduler, PollTargets targets = PollTargets())
+            : _scheduler(scheduler), _targets(targets), _start(0), _depth_sum(0), _samples(0), _requests(0), _errors(0),
+              _depth(0), _error_rate(0), _round_trip(0), _increases(0), _decreases(0), _congested(false)
+        {
+        }
+
+        // Called every poll round, with the requests waiting in the client queue and the request and
+        // error counters and the round trip of the client. Returns true when the periods changed.
+        bool update(uint32_t now, uint16_t pending, uint32_t requests, uint32_t errors, uint32_t round_trip)
+        {
+            _depth_sum += pending;
+            _samples++;
+            if (now - _start < _targets._interval)
+                return false;
+
+            _depth = float(_depth_sum) / _samples;
+            _round_trip = round_trip;
+            _congested = _depth > _targets._depth;
+            // The errors are judged once enough requests were sent, or sooner when there are already
+            // more than the target allows over that many. Then they are counted anew.
+            uint32_t sent = requests - _requests;
+            uint32_t failed = errors - _errors;
+            if (sent >= _targets._min_requests || failed > _targets._errors * _targets._min_requests)
+            {
+                _error_rate = float(failed) / sent;
+                _congested |= _error_rate > _targets._errors;
+                _requests = requests;
+                _errors = errors;
+            }
+            _scheduler.adapt(_congested);
+            if (_congested)
+                _decreases++;
+            else
+                _increases++;
+
+            _start = now;
+            _depth_sum = 0;
+            _samples = 0;
+            return true;
+        }
+
+        String allValuesAsString() const
+        {
+            String r;
+            char buf[200];
+            sprintf(buf, "Poll control: depth=%.2f (target %.2f), errors=%.1f%% (target %.1f%%), round trip=%ums, increases=%u, decreases=%u, last=%s\r\n",
+                    _depth, _targets._depth, _error_rate * 100, _targets._errors * 100, _round_trip, _increases, _decreases,
+                    _congested ? "slower" : "faster");
+            r += buf;
+            return r;
+        }
+
+    private:
+        PollScheduler &_scheduler;
+        PollTargets _targets;
+        // Of the current interval, and of the requests since the errors were judged
+        uint32_t _start;
+        uint32_t _depth_sum;
+        uint32_t _samples;
+        uint32_t _requests;
+        uint32_t _errors;
+        // Measured over the last interval, the error rate over the last judged requests
+        float _depth;
+        float _error_rate;
+        uint32_t _round_trip;
+        uint32_t _increases;
+        uint32_t _decreases;
+        bool _congested;
+    };
+}
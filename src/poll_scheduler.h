@@ -0,0 +1,186 @@
+/**
+ * @file      poll_scheduler.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Decides which reads to send to the meter and when
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <vector>
+#include "read_plan.h"
+
+namespace modbus_gateway
+{
+    // Earliest deadline first scheduling of periodic read jobs. A job is due every period; of the due jobs
+    // the one that is due the longest is issued first. The scheduler never queues more requests than the
+    // client queue holds: a job of priority p needs its own requests plus p * reserve free places. When
+    // there is no room a job of priority 0 waits, a job of lower priority is shed until its next period.
+    // A job whose values are older than its maximum staleness is treated as priority 0.
+    // adapt() changes the periods between a minimum period and the maximum staleness, see PollController.
+    // Time is passed in by the caller, so the scheduler doesn't depend on a clock.
+    class PollScheduler
+    {
+    public:
+        PollScheduler(uint16_t depth, uint16_t reserve = 2) : _depth(depth), _reserve(reserve) {}
+
+        // The first poll of the job is due now. min_period 0 is a fixed period.
+        void add(const char *name, const ReadPlan &plan, uint32_t period, uint8_t priority, uint32_t max_staleness, uint32_t now, uint32_t min_period = 0)
+        {
+            uint32_t floor = min_period == 0 ? period : std::min(min_period, period);
+            uint32_t ceiling = min_period == 0 ? period : std::max(max_staleness, period);
+            _jobs.push_back(Job{name, plan, period, priority, max_staleness, now, now, now, 0, 0, 0, floor, ceiling});
+        }
+
+        // Shift the polls of the named job, keeping its period, so that one of them is at at, e.g. just
+        // before the data is needed. Ignored when at is in the past or later than a pending alignment.
+        void align(const char *name, uint32_t at, uint32_t now)
+        {
+            for (auto j = _jobs.begin(); j < _jobs.end(); j++)
+            {
+                if (strcmp(j->_name, name) != 0 || j->_period == 0)
+                    continue;
+                if (int32_t(at - now) <= 0)
+                    return;
+                if (int32_t(j->_target - now) > 0 && int32_t(j->_target - at) < 0)
+                    return;
+                uint32_t offset = (at - now) % j->_period;
+                j->_target = at;
+                j->_due = now + (offset == 0 ? j->_period : offset);
+                j->_aligned++;
+                return;
+            }
+        }
+
+        // Issue the due jobs. pending is the number of requests in the client queue. issue(const ReadPlan &)
+        // sends the requests of a job. Returns the number of requests issued.
+        template <typename ISSUE>
+        uint16_t run(uint32_t now, uint16_t pending, ISSUE issue)
+        {
+            uint16_t issued = 0;
+            for (;;)
+            {
+                Job *job = nullptr;
+                for (auto j = _jobs.begin(); j < _jobs.end(); j++)
+                {
+                    if (int32_t(now - j->_due) >= 0 && (job == nullptr || int32_t(j->_due - job->_due) < 0))
+                        job = &*j;
+                }
+                if (job == nullptr)
+                    break;
+
+                uint8_t priority = job->_priority;
+                if (job->_max_staleness > 0 && now - job->_last >= job->_max_staleness)
+                    priority = 0;
+                uint32_t used = uint32_t(pending) + issued;
+                uint32_t free = used < _depth ? _depth - used : 0;
+                if (free < job->_plan.size() + uint32_t(priority) * _reserve)
+                {
+                    if (priority == 0)
+                        break;
+                    job->_shed++;
+                    next(*job, now);
+                    continue;
+                }
+
+                issue(job->_plan);
+                issued += job->_plan.size();
+                job->_issued++;
+                job->_last = now;
+                next(*job, now);
+            }
+            return issued;
+        }
+
+        // AIMD on the poll rates. Congested: every period doubles. Otherwise the poll rate of every job
+        // grows by a sixteenth of its highest rate. A shorter period applies from the last poll on.
+        void adapt(bool congested)
+        {
+            for (auto j = _jobs.begin(); j < _jobs.end(); j++)
+            {
+                if (j->_min_period == j->_max_period)
+                    continue;
+                uint32_t p;
+                if (congested)
+                    p = j->_period * 2;
+                else
+                    p = uint64_t(j->_period) * 16 * j->_min_period / (uint64_t(16) * j->_min_period + j->_period);
+                p = std::min(std::max(p, j->_min_period), j->_max_period);
+                if (p < j->_period && int32_t(j->_last + p - j->_due) < 0)
+                    j->_due = j->_last + p;
+                j->_period = p;
+            }
+        }
+
+        // ms until the next job is due, 0 when one is due now
+        uint32_t next(uint32_t now) const
+        {
+            uint32_t r = 0xffffffff;
+            for (auto j = _jobs.begin(); j < _jobs.end(); j++)
+            {
+                int32_t d = int32_t(j->_due - now);
+                if (d <= 0)
+                    return 0;
+                if (uint32_t(d) < r)
+                    r = d;
+            }
+            return r;
+        }
+
+        // The current period of the named job, 0 when there is none
+        uint32_t period(const char *name) const
+        {
+            for (auto j = _jobs.begin(); j < _jobs.end(); j++)
+            {
+                if (strcmp(j->_name, name) == 0)
+                    return j->_period;
+            }
+            return 0;
+        }
+
+        String allValuesAsString(uint32_t now) const
+        {
+            String result;
+            char buf[200];
+            for (auto j = _jobs.begin(); j < _jobs.end(); j++)
+            {
+                sprintf(buf, "Poll %s: period=%ums (%u-%u), priority=%u, requests=%u, issued=%u, shed=%u, aligned=%u, age=%ums\r\n",
+                        j->_name, j->_period, j->_min_period, j->_max_period, j->_priority, unsigned(j->_plan.size()), j->_issued, j->_shed, j->_aligned, now - j->_last);
+                result += buf;
+            }
+            return result;
+        }
+
+    private:
+        struct Job
+        {
+            const char *_name;
+            ReadPlan _plan;
+            uint32_t _period;
+            uint8_t _priority;
+            uint32_t _max_staleness;
+            uint32_t _due;
+            uint32_t _last;
+            uint32_t _target;
+            uint32_t _issued;
+            uint32_t _shed;
+            uint32_t _aligned;
+            uint32_t _min_period;
+            uint32_t _max_period;
+        };
+
+        // Keep the period, unless the job fell more than a period behind
+        static void next(Job &job, uint32_t now)
+        {
+            job._due += job._period;
+            if (int32_t(now - job._due) >= 0)
+                job._due = now + job._period;
+        }
+
+        std::vector<Job> _jobs;
+        uint16_t _depth;
+        uint16_t _reserve;
+    };
+}
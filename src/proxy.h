@@ -0,0 +1,197 @@
+/**
+ * @file      proxy.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Modbus TCP pass-through to a meter, answered from the client's registers when they are fresh
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "client.h"
+
+namespace modbus_gateway
+{
+    // A handler for TcpFrontEnd that lets other masters read the meter through the gateway, so the meter
+    // has one master. FC03 ranges whose registers all arrived within the ttl of their block are answered
+    // from the client; everything else is a miss. A miss for the same function, address and length as
+    // one already on its way waits for that one, so concurrent misses cost one request to the meter.
+    // At most SLOTS different misses are outstanding, more are answered with SERVER_DEVICE_BUSY. A miss
+    // that is not answered within the timeout is abandoned once nobody waits for it, so its slot can be
+    // used again; a late answer is then dropped. Writes are refused.
+    template <typename MODBUS_TYPE, uint16_t SLOTS = 4>
+    class Proxy
+    {
+    public:
+        Proxy(Client<MODBUS_TYPE> &client, uint32_t timeout = 3000)
+            : _client(client), _timeout(timeout), _hits(0), _misses(0), _collapsed(0), _failed(0), _timeouts(0), _abandoned(0) {}
+        Proxy(const Proxy &) = delete;
+        Proxy &operator=(const Proxy &) = delete;
+
+        bool serve(const ModbusMessage &request, ModbusMessage &response, uint32_t &ticket, uint32_t now)
+        {
+            if (ticket != 0)
+                return wait(request, response, ticket, now);
+
+            uint8_t fc = request.getFunctionCode();
+            if ((fc != READ_HOLD_REGISTER && fc != READ_INPUT_REGISTER) || request.size() != 6)
+            {
+                response.setError(request.getServerID(), fc, ILLEGAL_FUNCTION);
+                return true;
+            }
+            uint16_t address;
+            uint16_t words;
+            request.get(2, address);
+            request.get(4, words);
+            if (words == 0 || words > 125)
+            {
+                response.setError(request.getServerID(), fc, ILLEGAL_DATA_VALUE);
+                return true;
+            }
+
+            uint8_t frame[3 + 250];
+            if (fc == READ_HOLD_REGISTER && _client.cached(address, words, now, frame + 3))
+            {
+                _hits++;
+                frame[0] = request.getServerID();
+                frame[1] = fc;
+                frame[2] = words * 2;
+                response.add((const uint8_t *)frame, uint16_t(3 + words * 2));
+                return true;
+            }
+
+            Miss *m = find(fc, address, words, now);
+            if (m != nullptr)
+                _collapsed++;
+            else
+            {
+                m = allocate(now);
+                if (m == nullptr || !_client.forward(m->_forwarded, fc, address, words))
+                {
+                    response.setError(request.getServerID(), fc, SERVER_DEVICE_BUSY);
+                    return true;
+                }
+                _misses++;
+                m->_fc = fc;
+                m->_address = address;
+                m->_words = words;
+                m->_issued = now;
+                m->_generation++;
+            }
+            m->_waiters++;
+            ticket = uint32_t(m - _slots) + 1 + (m->_generation << 8);
+            return false;
+        }
+
+        void abandon(uint32_t ticket)
+        {
+            Miss *m = slot(ticket);
+            if (m != nullptr)
+                m->_waiters--;
+        }
+
+        String allValuesAsString() const
+        {
+            String r;
+            char buf[200];
+            sprintf(buf, "Proxy: hits=%u, misses=%u, collapsed=%u, failed=%u, timeouts=%u, abandoned=%u\r\n", _hits, _misses, _collapsed, _failed, _timeouts, _abandoned);
+            r += buf;
+            return r;
+        }
+
+    private:
+        struct Miss
+        {
+            Forwarded _forwarded;
+            uint8_t _fc = 0;
+            uint16_t _address = 0;
+            uint16_t _words = 0;
+            uint32_t _issued = 0;
+            uint32_t _generation = 0;
+            uint16_t _waiters = 0;
+        };
+
+        // An outstanding miss for the same range that is not timed out yet
+        Miss *find(uint8_t fc, uint16_t address, uint16_t words, uint32_t now)
+        {
+            for (auto m = _slots; m < _slots + SLOTS; m++)
+            {
+                if (m->_forwarded._state.load(std::memory_order_acquire) == Forwarded::pending && m->_fc == fc &&
+                    m->_address == address && m->_words == words && now - m->_issued < _timeout)
+                    return m;
+            }
+            return nullptr;
+        }
+
+        // A slot nobody waits for and the eModbus task no longer writes to. A timed out miss is abandoned:
+        // claiming its token keeps a late answer out.
+        Miss *allocate(uint32_t now)
+        {
+            for (auto m = _slots; m < _slots + SLOTS; m++)
+            {
+                if (m->_waiters != 0)
+                    continue;
+                if (m->_forwarded._state.load(std::memory_order_acquire) != Forwarded::pending)
+                    return m;
+                if (now - m->_issued >= _timeout && m->_forwarded.claim(m->_forwarded._token.load(std::memory_order_acquire)))
+                {
+                    m->_forwarded._state.store(Forwarded::idle, std::memory_order_relaxed);
+                    _abandoned++;
+                    return m;
+                }
+            }
+            return nullptr;
+        }
+
+        Miss *slot(uint32_t ticket)
+        {
+            uint32_t i = (ticket & 0xff) - 1;
+            if (i >= SLOTS || (_slots[i]._generation & 0xffffff) != (ticket >> 8))
+                return nullptr;
+            return &_slots[i];
+        }
+
+        bool wait(const ModbusMessage &request, ModbusMessage &response, uint32_t &ticket, uint32_t now)
+        {
+            Miss *m = slot(ticket);
+            uint8_t state = m != nullptr ? m->_forwarded._state.load(std::memory_order_acquire) : uint8_t(Forwarded::failed);
+            if (state == Forwarded::pending && now - m->_issued < _timeout)
+                return false;
+
+            if (state == Forwarded::done && m->_forwarded._length >= 2)
+            {
+                // The meter's answer, with the unit ID of this request
+                response.add(request.getServerID());
+                response.add((const uint8_t *)m->_forwarded._response + 1, uint16_t(m->_forwarded._length - 1));
+            }
+            else if (state == Forwarded::failed && m != nullptr && m->_forwarded._error < 0x80)
+            {
+                // An exception from the meter is passed on
+                _failed++;
+                response.setError(request.getServerID(), request.getFunctionCode(), m->_forwarded._error);
+            }
+            else
+            {
+                if (state == Forwarded::pending)
+                    _timeouts++;
+                else
+                    _failed++;
+                response.setError(request.getServerID(), request.getFunctionCode(), GATEWAY_TARGET_NO_RESP);
+            }
+            if (m != nullptr)
+                m->_waiters--;
+            return true;
+        }
+
+        Client<MODBUS_TYPE> &_client;
+        uint32_t _timeout;
+        Miss _slots[SLOTS];
+        uint32_t _hits;
+        uint32_t _misses;
+        uint32_t _collapsed;
+        uint32_t _failed;
+        uint32_t _timeouts;
+        uint32_t _abandoned;
+    };
+}
@@ -0,0 +1,67 @@
+/**
+ * @file      read_plan.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Plan the FC03 requests needed to read a set of registers
+ */
+#pragma once
+
+#include <vector>
+#include <string.h>
+#include <algorithm>
+#include "definitions.h"
+
+namespace modbus_gateway
+{
+    // One FC03 request
+    struct ReadRange
+    {
+        uint16_t _start;
+        uint16_t _words;
+    };
+    using ReadPlan = std::vector<ReadRange>;
+
+    // The fewest FC03 requests that read the given registers. Two registers end up in the same request
+    // when at most gap unused registers lie between them and the request stays within max_words.
+    // Registers outside the named blocks are left out; no names means all blocks.
+    template <typename MODBUS_TYPE>
+    ReadPlan planReads(const DeviceDescription<MODBUS_TYPE> &dd, const std::vector<typename MODBUS_TYPE::e_registers> &registers,
+                       std::initializer_list<const char *> blocks, uint16_t gap, uint16_t max_words = 125)
+    {
+        std::vector<ReadRange> spans;
+        for (auto r = registers.begin(); r < registers.end(); r++)
+        {
+            const RegisterReference &rr = dd._rr[*r];
+            if (rr._block_idx < 0 || rr._register_idx < 0)
+                continue;
+            const BlockDescription &bd = dd._bds[rr._block_idx];
+            bool selected = blocks.size() == 0;
+            for (const char *b : blocks)
+                selected |= strcmp(b, bd._name) == 0;
+            if (selected)
+                spans.push_back(ReadRange{bd._rds[rr._register_idx]._offset, bd._rds[rr._register_idx]._number});
+        }
+        std::sort(spans.begin(), spans.end(), [](const ReadRange &a, const ReadRange &b)
+                  { return a._start < b._start; });
+
+        ReadPlan plan;
+        for (auto s = spans.begin(); s < spans.end(); s++)
+        {
+            if (!plan.empty())
+            {
+                ReadRange &last = plan.back();
+                uint32_t end = uint32_t(last._start) + last._words;
+                uint32_t s_end = uint32_t(s->_start) + s->_words;
+                if (s->_start <= end + gap && std::max(end, s_end) - last._start <= max_words)
+                {
+                    last._words = std::max(end, s_end) - last._start;
+                    continue;
+                }
+            }
+            plan.push_back(*s);
+        }
+        return plan;
+    }
+}
@@ -0,0 +1,138 @@
+/**
+ * @file      response_cache.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Ready-to-send FC03 responses for the ranges the inverter keeps asking for
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "ModbusMessage.h"
+
+namespace modbus_gateway
+{
+    // Keeps the serialized FC03 response for the most recently seen (address, words) ranges.
+    // Ranges are recorded on a miss; the frames are built when new data is published and are part of
+    // the published snapshot, so a repeated read is a lookup and a copy without any lock.
+    template <uint16_t N>
+    class ResponseCache
+    {
+    public:
+        struct Entry
+        {
+            uint32_t _key;
+            uint16_t _length;
+            uint8_t _frame[3 + 250];
+        };
+        // The frames as published. Entry i is built for the range in slot i.
+        struct Frames
+        {
+            Entry _entries[N] = {};
+        };
+
+        ResponseCache() : _next(0), _hits(0), _misses(0)
+        {
+            for (uint16_t i = 0; i < N; i++)
+            {
+                _keys[i].store(0);
+                _slot_hits[i].store(0);
+            }
+        }
+
+        // Reader side. Copy the frame for the range out of the published frames, returns the slot or -1
+        int32_t find(const Frames &frames, uint16_t address, uint16_t words, uint8_t *frame, uint16_t &length) const
+        {
+            uint32_t key = makeKey(address, words);
+            for (uint16_t i = 0; i < N; i++)
+            {
+                const Entry &e = frames._entries[i];
+                if (e._key == key && e._length <= sizeof(e._frame))
+                {
+                    length = e._length;
+                    memcpy(frame, e._frame, length);
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        // Reader side. Count the outcome of find(); a missed range gets a slot so the next publication builds it
+        void count(int32_t slot, uint16_t address, uint16_t words)
+        {
+            if (slot >= 0)
+            {
+                _hits.fetch_add(1, std::memory_order_relaxed);
+                _slot_hits[slot].fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            _misses.fetch_add(1, std::memory_order_relaxed);
+            uint32_t key = makeKey(address, words);
+            for (uint16_t i = 0; i < N; i++)
+            {
+                if (_keys[i].load(std::memory_order_relaxed) == key)
+                    return;
+            }
+            uint16_t i = _next.fetch_add(1, std::memory_order_relaxed) % N;
+            _slot_hits[i].store(0, std::memory_order_relaxed);
+            _keys[i].store(key, std::memory_order_relaxed);
+        }
+
+        // Writer side. Build the frames of all recorded ranges. fill(address, words, bytes) writes the
+        // big endian register values.
+        template <typename FILL>
+        void rebuild(Frames &frames, uint8_t serverID, FILL fill) const
+        {
+            for (uint16_t i = 0; i < N; i++)
+            {
+                Entry &e = frames._entries[i];
+                e._key = _keys[i].load(std::memory_order_relaxed);
+                uint16_t words = e._key & 0xffff;
+                if (words == 0 || words > 125)
+                {
+                    e._key = 0;
+                    continue;
+                }
+                e._frame[0] = serverID;
+                e._frame[1] = READ_HOLD_REGISTER;
+                e._frame[2] = words * 2;
+                e._length = 3 + words * 2;
+                fill(e._key >> 16, words, e._frame + 3);
+            }
+        }
+
+        String allValuesAsString() const
+        {
+            String result;
+            char buf[100];
+            sprintf(buf, "Response cache: hits=%u, misses=%u\r\n", hits(), misses());
+            result += buf;
+            for (uint16_t i = 0; i < N; i++)
+            {
+                uint32_t key = _keys[i].load(std::memory_order_relaxed);
+                if (key == 0)
+                    continue;
+                sprintf(buf, "  start=%u length=%u hits=%u\r\n", key >> 16, key & 0xffff, _slot_hits[i].load(std::memory_order_relaxed));
+                result += buf;
+            }
+            return result;
+        }
+
+        uint32_t hits() const { return _hits.load(std::memory_order_relaxed); }
+        uint32_t misses() const { return _misses.load(std::memory_order_relaxed); }
+
+    private:
+        static uint32_t makeKey(uint16_t address, uint16_t words)
+        {
+            return (uint32_t(address) << 16) | words;
+        }
+
+        std::atomic<uint32_t> _keys[N];
+        std::atomic<uint32_t> _slot_hits[N];
+        std::atomic<uint16_t> _next;
+        std::atomic<uint32_t> _hits;
+        std::atomic<uint32_t> _misses;
+    };
+}
@@ -10,40 +10,109 @@
 
 #include "mutex"
 #include "definitions.h"
-#include "ModbusServerRTU.h"
+#include "response_cache.h"
+#include "snapshot.h"
+#include "cadence.h"
+#include "bus.h"
 
 namespace modbus_gateway
 {
+    // A virtual slave with its own register image. Several servers, of the same or different types, can
+    // share one RTU bus by attaching to the same Bus with their own server ID.
     template <typename MODBUS_TYPE>
-    class Server
+    class Server : public Slave
     {
     public:
         using RegisterType = typename MODBUS_TYPE::e_registers;
 
-        Server(ModbusServer &rtu, uint8_t rtuServerId, uint32_t serialNumber)
-            : _device(MODBUS_TYPE::getDeviceDescription(rtuServerId, serialNumber)), _rtu(rtu)
+        Server(Bus &bus, uint8_t rtuServerId, uint32_t serialNumber)
+            : _device(MODBUS_TYPE::getDeviceDescription()), _serverId(rtuServerId)
         {
-            _THIS = this;
-            _rtu.registerWorker(rtuServerId, READ_HOLD_REGISTER, &FC03);
-            _rtu.registerWorker(rtuServerId, WRITE_HOLD_REGISTER, &FC06);
-            _rtu.registerWorker(rtuServerId, WRITE_MULT_REGISTERS, &FC16);
+            {
+                DataAccess<Server<MODBUS_TYPE>> dataaccess(*this);
+                MODBUS_TYPE::setIdentity(dataaccess, rtuServerId, serialNumber);
+                // Fill both buffers of the snapshot, so they are sized before the first request
+                publish(dataaccess);
+                publish(dataaccess);
+            }
+            bus.attach(rtuServerId, *this);
         }
+        Server(const Server &) = delete;
+        Server &operator=(const Server &) = delete;
         Device<MODBUS_TYPE> _device;
 
-    private:
-        static ModbusMessage FC06(ModbusMessage request)
+        ModbusMessage serve(const ModbusMessage &request) override
+        {
+            switch (request.getFunctionCode())
+            {
+            case READ_HOLD_REGISTER:
+            case WRITE_HOLD_REGISTER:
+            case WRITE_MULT_REGISTERS:
+                return Process(request, FunctionCode(request.getFunctionCode()));
+            }
+            ModbusMessage response;
+            response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_FUNCTION);
+            return response;
+        }
+
+        // Reads from the published snapshot, which are kept out of the inverter statistics and the log
+        ModbusMessage serveReadOnly(const ModbusMessage &request) override
+        {
+            ModbusMessage response;
+            if (request.getFunctionCode() != READ_HOLD_REGISTER || request.size() < 6)
+            {
+                response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_FUNCTION);
+                return response;
+            }
+            uint16_t address;
+            uint16_t words;
+            request.get(2, address);
+            request.get(4, words);
+            return read(request, address, words, false);
+        }
+
+        String cacheAsString() const
+        {
+            String r = _cache.allValuesAsString();
+            char buf[100];
+            sprintf(buf, "Snapshot: version=%u, read retries=%u\r\n", _published.version(), _published.retries());
+            r += buf;
+            return r;
+        }
+
+        // Formats the log, without locking the device
+        String logAsString() const
+        {
+            return _log.allValuesAsString();
+        }
+
+        // When the inverter asks for which range and how old the served data was
+        String timingAsString() const
         {
-            return Process(request, WRITE_HOLD_REGISTER);
+            uint32_t now = millis();
+            String r = "Requests:\r\n";
+            r += _cadence.allValuesAsString(now);
+            r += _age.allValuesAsString();
+            return r;
         }
-        static ModbusMessage FC16(ModbusMessage request)
+        // See Cadence::predictions
+        template <typename F>
+        void predictions(uint32_t now, F f) const
         {
-            return Process(request, WRITE_MULT_REGISTERS);
+            _cadence.predictions(now, f);
         }
-        static ModbusMessage FC03(ModbusMessage request)
+        // Changes with every publication of new values
+        uint32_t version() const
         {
-            return Process(request, READ_HOLD_REGISTER);
+            return _published.version();
         }
-        static ModbusMessage Process(ModbusMessage request, FunctionCode fc)
+        uint32_t cadenceVersion() const
+        {
+            return _cadence.version();
+        }
+
+    private:
+        ModbusMessage Process(const ModbusMessage &request, FunctionCode fc)
         {
             uint16_t address;       // requested register address
             uint16_t words;         // requested number of registers
@@ -53,88 +122,109 @@ namespace modbus_gateway
             request.get(2, address);
             request.get(4, words);
             // Serial.printf("FC03 address:%i words:%i\r\n", address, words);
-            DataAccess<Server<MODBUS_TYPE>> dataaccess(*_THIS);
 
-            if (fc == WRITE_MULT_REGISTERS || fc == WRITE_HOLD_REGISTER)
-            {
-                uint16_t i = 0;
-                char hexstr[200];
-                for (i = 0; i < request.size() && i < 200 / 3; i++)
-                {
-                    uint8_t b = request.data()[i];
-                    sprintf(hexstr + i * 3, "%02x ", b);
-                }
-                hexstr[i * 3] = 0;
-                char buffer[200];
-                sprintf(buffer, "Writing: serverID=%d, FC=%d, start=%d, length=%d, size=%d, b=%s", request.getServerID(), request.getFunctionCode(), address, words, request.size(), hexstr);
-                dataaccess.logMessage(buffer);
-            }
-            // Find the block
-            int32_t block_index = -1;
-            for (auto i = _THIS->_device._dd._bds.begin(); i < _THIS->_device._dd._bds.end(); i++)
-            {
-                if (i->_offset <= address && (i->_offset + i->_number_reg) >= (address + words))
-                {
-                    block_index = i - _THIS->_device._dd._bds.begin();
-                    break;
-                }
-            }
+            // Reads are served from the published snapshot and never wait for the converter
+            if (fc == READ_HOLD_REGISTER)
+                return read(request, address, words, true);
 
-            // Did we find the block?
-            if (block_index >= 0)
+            DataAccess<Server<MODBUS_TYPE>> dataaccess(*this);
+
+            if (fc == WRITE_MULT_REGISTERS || fc == WRITE_HOLD_REGISTER)
+                dataaccess.logEvent(server_write, request.getServerID(), request.getFunctionCode(), address, words, request.size());
+            // The register image is indexed by address, so no block lookup is needed and a range may span blocks
+            if (_device.containsRange(address, words) && words <= 125)
             {
-                if (fc == READ_HOLD_REGISTER)
-                {
-                    // Looks okay. Set up message with serverID, FC and length of data
-                    response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)(words * 2));
-                    // Fill response with requested data
-                    for (uint16_t i = address; i < address + words; ++i)
-                    {
-                        uint16_t v = dataaccess.getRegisterValue(block_index, i - _THIS->_device._dd._bds[block_index]._offset);
-                        response.add(v);
-                    }
-                    char buffer[200];
-                    sprintf(buffer, "Response: serverID=%d, FC=%d, start=%d length=%d block=%s", response.getServerID(), response.getFunctionCode(), address, words, _THIS->_device._dd._bds[block_index]._name.c_str());
-                    // Serial.printf("%s\r\n", buffer);
-                    dataaccess.logMessage(buffer);
-                }
                 if (fc == WRITE_MULT_REGISTERS)
                 {
                     response.add(request.getServerID(), request.getFunctionCode(), (uint8_t)(words * 2));
-                    for (uint16_t i = address; i < address + words; ++i)
-                    {
-                        uint16_t v = 0;
-                        request.get(7 + (i - address) * 2, v);
-                        dataaccess.setRegisterValue(block_index, i - _THIS->_device._dd._bds[block_index]._offset, v);
-                        char buffer[200];
-                        sprintf(buffer, "%04x", v);
-                        dataaccess.logMessage(buffer);
-
-                        //  request.get()
-                        //  response.add(v);
-                    }
-                    char buffer[200];
-                    sprintf(buffer, "Writing: serverID=%d, FC=%d, start=%d length=%d block=%s", request.getServerID(), request.getFunctionCode(), address, words, _THIS->_device._dd._bds[block_index]._name.c_str());
-                    // Serial.printf("%s\r\n", buffer);
-                    dataaccess.logMessage(buffer);
+                    uint16_t available = request.size() > 7 ? (request.size() - 7) / 2 : 0;
+                    const uint8_t *bytes = request.data() + 7;
+                    dataaccess.writeRegisters(address, std::min(words, available), bytes);
+                    for (uint16_t i = 0; i < words && i < available; ++i)
+                        dataaccess.logEvent(server_write_register, address + i, (bytes[i * 2] << 8) | bytes[i * 2 + 1]);
+                    publish(dataaccess);
+                    dataaccess.logEvent(server_written, request.getServerID(), request.getFunctionCode(), address, words);
                 }
             }
             else
             {
                 // No, either address or words are outside the limits. Set up error response.
                 response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
-                char buffer[200];
-                sprintf(buffer, "Error: serverID=%d, FC=%d, length=%d", response.getServerID(), response.getFunctionCode(), response.size());
-                // Serial.printf("%s\r\n", buffer);
-                dataaccess.logMessage(buffer);
+                dataaccess.logEvent(server_range_error, request.getServerID(), request.getFunctionCode(), address, words);
             }
             return response;
         }
+        // inverter: the request came over the bus and is counted in the cadence, age and cache statistics
+        ModbusMessage read(const ModbusMessage &request, uint16_t address, uint16_t words, bool inverter)
+        {
+            ModbusMessage response;
+            if (!_device.containsRange(address, words) || words > 125)
+            {
+                response.setError(request.getServerID(), request.getFunctionCode(), ILLEGAL_DATA_ADDRESS);
+                if (inverter)
+                    _log.add(server_range_error, request.getServerID(), request.getFunctionCode(), address, words);
+                return response;
+            }
+            uint32_t now = millis();
+            if (inverter)
+                _cadence.arrival(address, words, now);
+
+            // Copy the cached frame, or assemble it from the register image of the snapshot
+            uint8_t frame[3 + 250];
+            uint16_t length = 0;
+            int32_t slot = -1;
+            uint32_t time = 0;
+            _published.read([&](const Published &p)
+                            {
+                time = p._time;
+                slot = _cache.find(p._frames, address, words, frame, length);
+                if (slot < 0)
+                {
+                    frame[0] = request.getServerID();
+                    frame[1] = request.getFunctionCode();
+                    frame[2] = words * 2;
+                    length = 3 + words * 2;
+                    _device.readRegisters(p._image.data(), address, words, frame + 3);
+                } });
+            response.add((const uint8_t *)frame, length);
+            if (!inverter)
+                return response;
+
+            _cache.count(slot, address, words);
+            _age.add(now - time);
+            _log.add(server_read, request.getServerID(), request.getFunctionCode(), address, words, slot >= 0);
+            return response;
+        }
+
+        // Publish the register image and rebuild the cached responses whenever the register values changed.
+        // Called with the device locked, which keeps a single writer on the snapshot.
+        void publish(const DataAccess<Server<MODBUS_TYPE>> &dataaccess)
+        {
+            _device.decode();
+            _published.publish([&](Published &p)
+                               {
+                p._time = millis();
+                dataaccess.copyImage(p._image);
+                _cache.rebuild(p._frames, _serverId, [&](uint16_t address, uint16_t words, uint8_t *bytes)
+                               { _device.readRegisters(p._image.data(), address, words, bytes); }); });
+        }
+
+        // What the readers see: a copy of the register image and the prepared responses
+        struct Published
+        {
+            std::vector<uint16_t> _image;
+            typename ResponseCache<8>::Frames _frames;
+            uint32_t _time = 0;
+        };
+
         modbus_gateway::Log _log;
+        ResponseCache<8> _cache;
+        Snapshot<Published> _published;
+        Cadence<8> _cadence;
+        AgeHistogram _age;
+        uint8_t _serverId;
         template <typename T>
         friend class DataAccess;
-        inline static Server<MODBUS_TYPE> *_THIS;
-        ModbusServer &_rtu;
         mutable std::timed_mutex _Mutex;
     };
 
@@ -0,0 +1,78 @@
+/**
+ * @file      snapshot.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Double buffered snapshot, published by one writer and read without locking
+ */
+#pragma once
+
+#include <atomic>
+#include <stdint.h>
+
+namespace modbus_gateway
+{
+    // Two buffers, each with a sequence number. The writer fills the buffer that is not published and
+    // then makes it the published one. Readers never take a lock: they copy what they need from the
+    // published buffer and only retry when the writer reused that buffer while they were copying,
+    // which takes two publications during one read.
+    // Only one writer at a time; callers serialize publish(), e.g. by holding the device mutex.
+    template <typename T>
+    class Snapshot
+    {
+    public:
+        Snapshot() : _version(0), _retries(0) {}
+        Snapshot(const Snapshot &) = delete;
+        Snapshot &operator=(const Snapshot &) = delete;
+
+        // fill(T &) writes the new values into the back buffer
+        template <typename FILL>
+        void publish(FILL fill)
+        {
+            uint32_t version = _version.load(std::memory_order_relaxed) + 1;
+            Buffer &b = _buffers[version & 1];
+            uint32_t seq = b._seq.load(std::memory_order_relaxed);
+            b._seq.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            fill(b._data);
+            b._seq.store(seq + 2, std::memory_order_release);
+            _version.store(version, std::memory_order_release);
+        }
+
+        // read(const T &) copies what it needs out of the published buffer. It may be called more
+        // than once and must not act on what it copied before read() returns. Returns the version.
+        template <typename READ>
+        uint32_t read(READ read) const
+        {
+            for (;;)
+            {
+                uint32_t version = _version.load(std::memory_order_acquire);
+                const Buffer &b = _buffers[version & 1];
+                uint32_t seq = b._seq.load(std::memory_order_acquire);
+                if ((seq & 1) == 0)
+                {
+                    read(b._data);
+                    std::atomic_thread_fence(std::memory_order_acquire);
+                    if (b._seq.load(std::memory_order_relaxed) == seq)
+                        return version;
+                }
+                _retries.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+
+        uint32_t version() const { return _version.load(std::memory_order_acquire); }
+        uint32_t retries() const { return _retries.load(std::memory_order_relaxed); }
+
+    private:
+        struct Buffer
+        {
+            Buffer() : _seq(0) {}
+            std::atomic<uint32_t> _seq;
+            T _data;
+        };
+        Buffer _buffers[2];
+        std::atomic<uint32_t> _version;
+        mutable std::atomic<uint32_t> _retries;
+    };
+}
@@ -0,0 +1,173 @@
+/**
+ * @file      snapshot_api.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Device values as JSON or CBOR, laid out after the DeviceDescription
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <math.h>
+#include "definitions.h"
+
+namespace modbus_gateway
+{
+    // A device as
+    //   {"name": .., "blocks": [{"name": .., "offset": .., "transaction": .., "generation": ..,
+    //     "registers": [raw values], "values": [{"offset": .., "desc": .., "value": .., "unit": ..}, ..]}, ..]}
+    // out(const char *, size_t) receives the text.
+    template <typename MODBUS_TYPE, typename OUT>
+    void writeJson(const Device<MODBUS_TYPE> &device, const typename Device<MODBUS_TYPE>::Values &v, OUT out)
+    {
+        char buf[200];
+        auto text = [&](const char *s)
+        { out(s, strlen(s)); };
+        // The names are constants, only quotes and backslashes need escaping
+        auto string = [&](const char *s)
+        {
+            text("\"");
+            for (const char *p = s; *p; p++)
+            {
+                if (*p == '"' || *p == '\\')
+                    text("\\");
+                out(p, 1);
+            }
+            text("\"");
+        };
+
+        const DeviceDescription<MODBUS_TYPE> &dd = device._dd;
+        text("{\"name\":");
+        string(dd._name);
+        text(",\"blocks\":[");
+        for (size_t b = 0; b < dd._bds.size(); b++)
+        {
+            const BlockDescription &bd = dd._bds[b];
+            const uint16_t *registers = device.blockRegisters(v, b);
+            text(b == 0 ? "{\"name\":" : ",{\"name\":");
+            string(bd._name);
+            sprintf(buf, ",\"offset\":%u,\"transaction\":%u,\"generation\":%u,\"registers\":[", bd._offset, v._transactions[b], v._generations[b]);
+            text(buf);
+            for (uint16_t r = 0; r < bd._number_reg; r++)
+            {
+                sprintf(buf, r == 0 ? "%u" : ",%u", registers[r]);
+                text(buf);
+            }
+            text("],\"values\":[");
+            for (auto i = bd._rds.begin(); i < bd._rds.end(); i++)
+            {
+                sprintf(buf, i == bd._rds.begin() ? "{\"offset\":%u,\"desc\":" : ",{\"offset\":%u,\"desc\":", i->_offset);
+                text(buf);
+                string(i->_desc);
+                char value[40];
+                i->format(&registers[i->_offset - bd._offset], value);
+                // nan and inf are not valid JSON numbers
+                bool number = isdigit(value[0]) || (value[0] == '-' && isdigit(value[1]));
+                text(",\"value\":");
+                text(number ? value : "null");
+                text(",\"unit\":");
+                string(i->_unit);
+                text("}");
+            }
+            text("]}");
+        }
+        text("]}");
+    }
+
+    // The same layout as writeJson in CBOR (RFC 8949). The raw registers are a byte string of big endian
+    // words, the values are float32.
+    template <typename MODBUS_TYPE, typename OUT>
+    void writeCbor(const Device<MODBUS_TYPE> &device, const typename Device<MODBUS_TYPE>::Values &v, OUT out)
+    {
+        auto head = [&](uint8_t major, uint32_t n)
+        {
+            uint8_t b[5];
+            size_t length = 1;
+            if (n < 24)
+                b[0] = (major << 5) | n;
+            else if (n < 0x100)
+            {
+                b[0] = (major << 5) | 24;
+                b[1] = n;
+                length = 2;
+            }
+            else if (n < 0x10000)
+            {
+                b[0] = (major << 5) | 25;
+                b[1] = n >> 8;
+                b[2] = n;
+                length = 3;
+            }
+            else
+            {
+                b[0] = (major << 5) | 26;
+                b[1] = n >> 24;
+                b[2] = n >> 16;
+                b[3] = n >> 8;
+                b[4] = n;
+                length = 5;
+            }
+            out((const char *)b, length);
+        };
+        auto string = [&](const char *s)
+        {
+            size_t n = strlen(s);
+            head(3, n);
+            out(s, n);
+        };
+        auto number = [&](float f)
+        {
+            uint8_t b[5] = {0xfa};
+            Value x = Value::_float32_t(f);
+            b[1] = x.ui32 >> 24;
+            b[2] = x.ui32 >> 16;
+            b[3] = x.ui32 >> 8;
+            b[4] = x.ui32;
+            out((const char *)b, 5);
+        };
+
+        const DeviceDescription<MODBUS_TYPE> &dd = device._dd;
+        head(5, 2);
+        string("name");
+        string(dd._name);
+        string("blocks");
+        head(4, dd._bds.size());
+        for (size_t b = 0; b < dd._bds.size(); b++)
+        {
+            const BlockDescription &bd = dd._bds[b];
+            const uint16_t *registers = device.blockRegisters(v, b);
+            const float *values = device.blockValues(v, b);
+            head(5, 6);
+            string("name");
+            string(bd._name);
+            string("offset");
+            head(0, bd._offset);
+            string("transaction");
+            head(0, v._transactions[b]);
+            string("generation");
+            head(0, v._generations[b]);
+            string("registers");
+            head(2, bd._number_reg * 2);
+            for (uint16_t r = 0; r < bd._number_reg; r++)
+            {
+                char w[2] = {char(registers[r] >> 8), char(registers[r])};
+                out(w, 2);
+            }
+            string("values");
+            head(4, bd._rds.size());
+            for (auto i = bd._rds.begin(); i < bd._rds.end(); i++)
+            {
+                head(5, 4);
+                string("offset");
+                head(0, i->_offset);
+                string("desc");
+                string(i->_desc);
+                string("value");
+                number(values[i - bd._rds.begin()]);
+                string("unit");
+                string(i->_unit);
+            }
+        }
+    }
+}
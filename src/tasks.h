@@ -0,0 +1,205 @@
+/**
+ * @file      tasks.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Worker tasks that sleep until notified or until their timeout, FreeRTOS or std::thread
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <functional>
+#ifdef ARDUINO
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#else
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace modbus_gateway
+{
+    // A task calls its work function, then sleeps until notify() or until the number of ms the work
+    // function returned, until stop(). On the ESP32 it is a FreeRTOS task pinned to a core, elsewhere a
+    // std::thread pinned to the core when the host has it, where the priority is ignored. All tasks are
+    // listed by allValuesAsString().
+    class Task
+    {
+    public:
+        static constexpr uint32_t forever = 0xffffffff;
+
+        Task(const char *name, uint32_t stack, uint8_t priority, int core, std::function<uint32_t()> work)
+            : _name(name), _stack(stack), _priority(priority), _core(core), _work(work), _runs(0), _busy(0), _started(0),
+              _running(false), _stop(false)
+        {
+            _next = _first;
+            _first = this;
+        }
+        ~Task()
+        {
+            stop();
+            for (Task **i = &_first; *i != nullptr; i = &(*i)->_next)
+            {
+                if (*i == this)
+                {
+                    *i = _next;
+                    break;
+                }
+            }
+        }
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        void start()
+        {
+            if (_running.exchange(true))
+                return;
+            _stop = false;
+            _started = now();
+#ifdef ARDUINO
+            xTaskCreatePinnedToCore(run, _name, _stack, this, _priority, &_handle, _core);
+#else
+            _thread = std::thread(run, this);
+            if (_core >= 0 && unsigned(_core) < std::thread::hardware_concurrency())
+            {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(_core, &cpus);
+                pthread_setaffinity_np(_thread.native_handle(), sizeof(cpus), &cpus);
+            }
+#endif
+        }
+
+        // Let the work function return, then end the task. Waits for the task to end, so it can't be
+        // called by the task itself.
+        void stop()
+        {
+            if (!_running.load())
+                return;
+            _stop = true;
+            notify();
+#ifdef ARDUINO
+            while (_running.load())
+                delay(1);
+#else
+            _thread.join();
+            _running = false;
+#endif
+        }
+
+        // Wake the task, can be called from any other task
+        void notify()
+        {
+#ifdef ARDUINO
+            if (_handle != nullptr)
+                xTaskNotifyGive(_handle);
+#else
+            std::lock_guard<std::mutex> lock(_mutex);
+            _notified = true;
+            _cv.notify_one();
+#endif
+        }
+
+        // Run count, share of the time spent in the work function and the unused stack of every task
+        static String allValuesAsString()
+        {
+            String r;
+            char buf[200];
+            uint64_t t = now();
+            for (Task *i = _first; i != nullptr; i = i->_next)
+            {
+                uint64_t elapsed = t - i->_started;
+                uint64_t busy = i->_busy.load(std::memory_order_relaxed);
+                sprintf(buf, "Task %s: core=%d, priority=%u, runs=%u, cpu=%ums (%u.%u%%), stack free=%u\r\n", i->_name, i->_core, i->_priority,
+                        i->_runs.load(std::memory_order_relaxed), uint32_t(busy / 1000), uint32_t(elapsed ? busy * 100 / elapsed : 0),
+                        uint32_t(elapsed ? busy * 1000 / elapsed % 10 : 0), i->stackFree());
+                r += buf;
+            }
+            return r;
+        }
+
+    private:
+        static void run(void *p)
+        {
+            Task *t = static_cast<Task *>(p);
+            while (!t->_stop.load())
+            {
+                uint64_t start = now();
+                uint32_t timeout = t->_work();
+                t->_busy.fetch_add(now() - start, std::memory_order_relaxed);
+                t->_runs.fetch_add(1, std::memory_order_relaxed);
+                if (!t->_stop.load())
+                    t->wait(timeout);
+            }
+#ifdef ARDUINO
+            t->_handle = nullptr;
+            t->_running = false;
+            vTaskDelete(nullptr);
+#endif
+        }
+
+        void wait(uint32_t timeout)
+        {
+#ifdef ARDUINO
+            ulTaskNotifyTake(pdTRUE, timeout == forever ? portMAX_DELAY : pdMS_TO_TICKS(timeout));
+#else
+            std::unique_lock<std::mutex> lock(_mutex);
+            auto notified = [this]
+            { return _notified; };
+            if (timeout == forever)
+                _cv.wait(lock, notified);
+            else
+                _cv.wait_for(lock, std::chrono::milliseconds(timeout), notified);
+            _notified = false;
+#endif
+        }
+
+        // Bytes of stack never used, 0 when unknown
+        uint32_t stackFree() const
+        {
+#ifdef ARDUINO
+            return _handle != nullptr ? uxTaskGetStackHighWaterMark(_handle) : 0;
+#else
+            return 0;
+#endif
+        }
+
+        // us
+        static uint64_t now()
+        {
+#ifdef ARDUINO
+            return esp_timer_get_time();
+#else
+            return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+        }
+
+        const char *_name;
+        uint32_t _stack;
+        uint8_t _priority;
+        int _core;
+        std::function<uint32_t()> _work;
+        std::atomic<uint32_t> _runs;
+        std::atomic<uint64_t> _busy;
+        uint64_t _started;
+        std::atomic<bool> _running;
+        std::atomic<bool> _stop;
+#ifdef ARDUINO
+        TaskHandle_t _handle = nullptr;
+#else
+        std::thread _thread;
+        std::mutex _mutex;
+        std::condition_variable _cv;
+        bool _notified = false;
+#endif
+        Task *_next;
+        static inline Task *_first = nullptr;
+    };
+}
@@ -0,0 +1,288 @@
+/**
+ * @file      tcp_front_end.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Modbus TCP access to the virtual slaves and to the meters
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <WiFi.h>
+#include <WiFiClient.h>
+#include <lwip/sockets.h>
+#include <errno.h>
+#include "bus.h"
+
+namespace modbus_gateway
+{
+    // Per connection limits. A connection may send rate requests per second, with bursts of up to burst
+    // requests; requests over the limit are answered with SERVER_DEVICE_BUSY. A connection without a
+    // request for idle ms is closed.
+    struct TcpLimits
+    {
+        uint16_t _rate = 20;
+        uint16_t _burst = 40;
+        uint32_t _idle = 60000;
+    };
+
+    // Read only access to the slaves on a bus for TcpFrontEnd. The unit ID selects the slave; the
+    // registers come from the slave's published snapshot, so TCP clients never take the lock of the RTU
+    // side and don't show up in the inverter statistics.
+    class BusReader
+    {
+    public:
+        BusReader(Bus &bus) : _bus(bus) {}
+
+        bool serve(const ModbusMessage &request, ModbusMessage &response, uint32_t &, uint32_t)
+        {
+            Slave *slave = _bus.slave(request.getServerID());
+            if (slave == nullptr)
+                response.setError(request.getServerID(), request.getFunctionCode(), GATEWAY_TARGET_NO_RESP);
+            else
+                response = slave->serveReadOnly(request);
+            return true;
+        }
+        void abandon(uint32_t) {}
+
+    private:
+        Bus &_bus;
+    };
+
+    // Serves up to CLIENTS Modbus TCP connections. HANDLER answers the requests:
+    //   bool serve(const ModbusMessage &request, ModbusMessage &response, uint32_t &ticket, uint32_t now)
+    // returns false when the answer is not there yet, after setting ticket. serve() is then called with
+    // the same request and ticket on every poll until it answers; abandon(ticket) is called instead
+    // when the connection closes. Later requests of the connection wait meanwhile.
+    // poll() accepts, reads and answers without blocking; one extra connection is accepted only to be
+    // closed at once.
+    template <typename HANDLER, uint16_t CLIENTS = 8>
+    class TcpFrontEnd
+    {
+    public:
+        TcpFrontEnd(HANDLER &handler, TcpLimits limits)
+            : _handler(handler), _listener(0, CLIENTS + 1), _limits(limits), _port(0),
+              _accepted(0), _refused(0), _requests(0), _limited(0), _malformed(0), _idle(0)
+        {
+        }
+        TcpFrontEnd(const TcpFrontEnd &) = delete;
+        TcpFrontEnd &operator=(const TcpFrontEnd &) = delete;
+
+        void begin(uint16_t port)
+        {
+            _port = port;
+            _listener.begin(port);
+            _listener.setNoDelay(true);
+        }
+
+        void poll(uint32_t now)
+        {
+            accept(now);
+            for (auto c = _connections; c < _connections + CLIENTS; c++)
+            {
+                if (!c->_used)
+                    continue;
+                if (!receive(*c) || !answer(*c, now) || !send(*c))
+                    continue;
+                if (now - c->_last > _limits._idle)
+                {
+                    _idle++;
+                    close(*c);
+                }
+            }
+        }
+
+        String allValuesAsString() const
+        {
+            String r;
+            char buf[200];
+            sprintf(buf, "Modbus TCP port %u: connections=%u/%u, accepted=%u, refused=%u, requests=%u, rate limited=%u, malformed=%u, idle closed=%u\r\n",
+                    _port, connections(), CLIENTS, _accepted, _refused, _requests, _limited, _malformed, _idle);
+            r += buf;
+            return r;
+        }
+
+    private:
+        // MBAP header, unit ID and at most 253 bytes of PDU
+        static constexpr size_t max_frame = 7 + 253;
+        // Frames answered per connection and poll, so one busy client doesn't starve the others
+        static constexpr uint16_t frames_per_poll = 4;
+
+        struct Connection
+        {
+            WiFiClient _client;
+            bool _used = false;
+            uint8_t _in[max_frame];
+            size_t _inLength = 0;
+            uint8_t _out[2 * max_frame];
+            size_t _outStart = 0;
+            size_t _outLength = 0;
+            uint32_t _last = 0;
+            uint32_t _refill = 0;
+            // Thousandths of a request
+            uint32_t _tokens = 0;
+            // Of the request the handler is still working on, 0 is none
+            uint32_t _ticket = 0;
+        };
+
+        uint16_t connections() const
+        {
+            uint16_t n = 0;
+            for (auto c = _connections; c < _connections + CLIENTS; c++)
+                n += c->_used;
+            return n;
+        }
+
+        void accept(uint32_t now)
+        {
+            for (WiFiClient client = _listener.available(); client; client = _listener.available())
+            {
+                Connection *c = _connections;
+                while (c < _connections + CLIENTS && c->_used)
+                    c++;
+                if (c == _connections + CLIENTS)
+                {
+                    _refused++;
+                    client.stop();
+                    continue;
+                }
+                _accepted++;
+                c->_client = client;
+                c->_client.setNoDelay(true);
+                c->_used = true;
+                c->_inLength = 0;
+                c->_outStart = 0;
+                c->_outLength = 0;
+                c->_last = now;
+                c->_refill = now;
+                c->_tokens = _limits._burst * 1000u;
+                c->_ticket = 0;
+            }
+        }
+
+        // Returns false when the connection is closed
+        bool receive(Connection &c)
+        {
+            if (c._inLength == sizeof(c._in))
+                return true;
+            int n = ::recv(c._client.fd(), c._in + c._inLength, sizeof(c._in) - c._inLength, MSG_DONTWAIT);
+            if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))
+                return true;
+            if (n <= 0)
+            {
+                close(c);
+                return false;
+            }
+            c._inLength += n;
+            return true;
+        }
+
+        // Answer the complete requests in the input while the output has room. Returns false when the
+        // connection is closed.
+        bool answer(Connection &c, uint32_t now)
+        {
+            c._tokens = std::min<uint64_t>(c._tokens + uint64_t(now - c._refill) * _limits._rate, _limits._burst * 1000u);
+            c._refill = now;
+            for (uint16_t f = 0; f < frames_per_poll && c._inLength >= 7; f++)
+            {
+                uint16_t protocol = (c._in[2] << 8) | c._in[3];
+                uint16_t length = (c._in[4] << 8) | c._in[5];
+                if (protocol != 0 || length < 2 || length > max_frame - 6)
+                {
+                    _malformed++;
+                    close(c);
+                    return false;
+                }
+                size_t size = 6 + length;
+                if (c._inLength < size || sizeof(c._out) - c._outLength < max_frame)
+                    break;
+                c._last = now;
+
+                ModbusMessage request;
+                request.add((const uint8_t *)c._in + 6, length);
+                ModbusMessage response;
+                if (c._ticket == 0 && c._tokens < 1000)
+                {
+                    _requests++;
+                    _limited++;
+                    response.setError(request.getServerID(), request.getFunctionCode(), SERVER_DEVICE_BUSY);
+                }
+                else
+                {
+                    if (c._ticket == 0)
+                    {
+                        _requests++;
+                        c._tokens -= 1000;
+                    }
+                    if (!_handler.serve(request, response, c._ticket, now))
+                        break;
+                    c._ticket = 0;
+                }
+
+                // The response gets the transaction ID of the request
+                if (c._outStart + c._outLength + 6 + response.size() > sizeof(c._out))
+                {
+                    memmove(c._out, c._out + c._outStart, c._outLength);
+                    c._outStart = 0;
+                }
+                uint8_t *out = c._out + c._outStart + c._outLength;
+                out[0] = c._in[0];
+                out[1] = c._in[1];
+                out[2] = 0;
+                out[3] = 0;
+                out[4] = response.size() >> 8;
+                out[5] = response.size();
+                memcpy(out + 6, response.data(), response.size());
+                c._outLength += 6 + response.size();
+
+                memmove(c._in, c._in + size, c._inLength - size);
+                c._inLength -= size;
+            }
+            return true;
+        }
+
+        // Returns false when the connection is closed
+        bool send(Connection &c)
+        {
+            while (c._outLength > 0)
+            {
+                int n = ::send(c._client.fd(), c._out + c._outStart, c._outLength, MSG_DONTWAIT);
+                if (n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))
+                    break;
+                if (n <= 0)
+                {
+                    close(c);
+                    return false;
+                }
+                c._outStart += n;
+                c._outLength -= n;
+            }
+            if (c._outLength == 0)
+                c._outStart = 0;
+            return true;
+        }
+
+        void close(Connection &c)
+        {
+            if (c._ticket != 0)
+                _handler.abandon(c._ticket);
+            c._ticket = 0;
+            c._client.stop();
+            c._client = WiFiClient();
+            c._used = false;
+        }
+
+        HANDLER &_handler;
+        WiFiServer _listener;
+        TcpLimits _limits;
+        uint16_t _port;
+        Connection _connections[CLIENTS];
+        uint32_t _accepted;
+        uint32_t _refused;
+        uint32_t _requests;
+        uint32_t _limited;
+        uint32_t _malformed;
+        uint32_t _idle;
+    };
+}
@@ -0,0 +1,134 @@
+/**
+ * @file      token_pool.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Fixed size pool of request contexts, addressed by the eModbus token
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <mutex>
+
+namespace modbus_gateway
+{
+    // Holds the context of up to N outstanding requests. acquire() returns a token made of the slot
+    // index and a generation, release() hands the context back. A token that was already released,
+    // or whose slot was reclaimed, has an old generation and is rejected, so a late or duplicate
+    // callback can't pick up the context of another request.
+    // release() is O(1), and so is acquire() while a slot is free. When all slots are in use acquire()
+    // looks for the oldest one, O(N), and reclaims it if it is older than the maximum age, as that
+    // request was dropped without a callback; otherwise acquire() fails. The owner
+    // learns about a reclaimed context through the reclaimed callback of acquire().
+    template <typename T, uint16_t N>
+    class TokenPool
+    {
+        static_assert(N > 0 && N < 0x8000);
+
+    public:
+        constexpr TokenPool() = default;
+        TokenPool(const TokenPool &) = delete;
+        TokenPool &operator=(const TokenPool &) = delete;
+
+        // Returns the token, or 0 when no slot is available
+        uint32_t acquire(const T &value, uint32_t now, uint32_t max_age)
+        {
+            return acquire(value, now, max_age, [](const T &, uint32_t) {});
+        }
+        // reclaimed(const T &value, uint32_t token) is called with the context and token of a reclaimed
+        // slot, with the lock of the pool held
+        template <typename RECLAIMED>
+        uint32_t acquire(const T &value, uint32_t now, uint32_t max_age, RECLAIMED reclaimed)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            int16_t i = _free;
+            if (i >= 0)
+                _free = _slots[i]._next;
+            else if (_fresh < N)
+                i = _fresh++;
+            else
+            {
+                i = oldest();
+                if (now - _slots[i]._acquired < max_age)
+                {
+                    _exhausted++;
+                    return 0;
+                }
+                reclaimed(_slots[i]._value, (uint32_t(_slots[i]._generation) << 16) | uint16_t(i));
+                _slots[i]._generation = nextGeneration(_slots[i]._generation);
+                _reclaimed++;
+                _in_use--;
+            }
+            Slot &s = _slots[i];
+            s._value = value;
+            s._acquired = now;
+            s._used = true;
+            _in_use++;
+            return (uint32_t(s._generation) << 16) | uint16_t(i);
+        }
+
+        // Copies the context to value and frees the slot. Returns false for a stale or unknown token.
+        bool release(uint32_t token, T &value)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            uint16_t i = token & 0xffff;
+            if (i >= N || !_slots[i]._used || _slots[i]._generation != (token >> 16))
+            {
+                _stale++;
+                return false;
+            }
+            Slot &s = _slots[i];
+            value = s._value;
+            s._used = false;
+            s._generation = nextGeneration(s._generation);
+            s._next = _free;
+            _free = i;
+            _in_use--;
+            return true;
+        }
+
+        String allValuesAsString() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            char buf[200];
+            sprintf(buf, "Request pool: size=%u, in use=%u, exhausted=%u, reclaimed=%u, stale tokens=%u\r\n", N, _in_use, _exhausted, _reclaimed, _stale);
+            return String(buf);
+        }
+
+    private:
+        struct Slot
+        {
+            T _value = {};
+            uint32_t _acquired = 0;
+            uint16_t _generation = 1;
+            int16_t _next = -1;
+            bool _used = false;
+        };
+
+        // Generation 0 is skipped so a token is never 0
+        static uint16_t nextGeneration(uint16_t g)
+        {
+            return ++g == 0 ? 1 : g;
+        }
+        int16_t oldest() const
+        {
+            int16_t result = 0;
+            for (int16_t i = 1; i < N; i++)
+            {
+                if (int32_t(_slots[i]._acquired - _slots[result]._acquired) < 0)
+                    result = i;
+            }
+            return result;
+        }
+
+        Slot _slots[N] = {};
+        int16_t _free = -1;
+        uint16_t _fresh = 0;
+        uint16_t _in_use = 0;
+        uint32_t _exhausted = 0;
+        uint32_t _reclaimed = 0;
+        uint32_t _stale = 0;
+        mutable std::mutex _mutex;
+    };
+}
@@ -0,0 +1,144 @@
+/**
+ * @file      bench_connection_pool.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Refresh rate of the EM24 blocks over one connection and over a pool of three, against a
+ *            simulated meter that takes longer to answer reads of the energy counters
+ */
+
+// The client measures round trips with millis(), so the meter answers in real time and each run takes a
+// few seconds.
+
+#include <WiFiClient.h>
+#include <thread>
+#include "check.h"
+#include "client.h"
+#include "em24_e1.h"
+#include "poll_scheduler.h"
+
+using namespace modbus_gateway;
+
+using EM24Client = modbus_gateway::Client<EM24_E1>;
+
+static const uint32_t duration = 6000;
+// ms to answer a read of each block: dynamic, energy, time and tariff
+static const uint32_t latency[] = {20, 400, 150, 150};
+
+// Answers the requests of each connection one at a time, as eModbus sends them
+class Meter
+{
+public:
+    Meter(std::vector<ModbusClientTCP *> connections) : _connections(connections), _busy(connections.size(), false),
+                                                        _done(connections.size(), 0) {}
+
+    void run(uint32_t now)
+    {
+        for (size_t c = 0; c < _connections.size(); c++)
+        {
+            ModbusClientTCP &tcp = *_connections[c];
+            if (_busy[c] && int32_t(now - _done[c]) >= 0)
+            {
+                tcp.respond([](uint16_t address)
+                            { return address; });
+                _busy[c] = false;
+            }
+            if (!_busy[c] && !tcp._queue.empty())
+            {
+                const auto &bds = EM24_E1::getDeviceDescription()._bds;
+                size_t b = 0;
+                while (b + 1 < bds.size() && tcp._queue.front()._address >= bds[b + 1]._offset)
+                    b++;
+                _busy[c] = true;
+                _done[c] = now + latency[b];
+            }
+        }
+    }
+
+private:
+    std::vector<ModbusClientTCP *> _connections;
+    std::vector<bool> _busy;
+    std::vector<uint32_t> _done;
+};
+
+// The largest gap is between arrivals, so the first read of a block doesn't count
+struct Refresh
+{
+    uint32_t _count = 0;
+    uint32_t _max_gap = 0;
+    uint32_t _last = 0;
+};
+
+// Polls all blocks at their period, as the firmware does, and records when each block arrives
+static std::vector<Refresh> poll(uint16_t connections)
+{
+    WiFiClient wifi;
+    std::vector<std::unique_ptr<ModbusClientTCP>> tcp;
+    std::vector<ModbusClientTCP *> pointers;
+    for (uint16_t i = 0; i < connections; i++)
+    {
+        tcp.emplace_back(new ModbusClientTCP(wifi, EM24Client::queue_limit));
+        pointers.push_back(tcp.back().get());
+    }
+    EM24Client client(*tcp[0], IPAddress(), 502, 1);
+    for (uint16_t i = 1; i < connections; i++)
+        client.addConnection(*tcp[i]);
+    client.connect();
+    Meter meter(pointers);
+
+    const auto &bds = client._device._dd._bds;
+    uint32_t start = millis();
+    PollScheduler scheduler(10);
+    for (const BlockDescription &bd : bds)
+        scheduler.add(bd._name, ReadPlan{ReadRange{bd._offset, bd._number_reg}}, bd._period, bd._priority, bd._max_staleness, start);
+
+    std::vector<Refresh> refresh(bds.size());
+    std::vector<uint32_t> generations(bds.size(), 0);
+    for (uint32_t now = start; now - start < duration; now = millis())
+    {
+        meter.run(now);
+        scheduler.run(now, client.pendingRequests(), [&](const ReadPlan &p)
+                      { return client.read(p); });
+        {
+            DataAccess<EM24Client> dataaccess(client);
+            for (size_t b = 0; b < bds.size(); b++)
+            {
+                if (dataaccess.generation(b) == generations[b])
+                    continue;
+                generations[b] = dataaccess.generation(b);
+                if (refresh[b]._count++ > 0)
+                    refresh[b]._max_gap = std::max(refresh[b]._max_gap, now - refresh[b]._last);
+                refresh[b]._last = now;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    // Let the meter answer what is still queued, so the request pool is empty for the next run
+    for (uint32_t now = millis(); client.pendingRequests() > 0; now = millis())
+    {
+        meter.run(now);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return refresh;
+}
+
+int main()
+{
+    const auto &bds = EM24_E1::getDeviceDescription()._bds;
+    std::vector<Refresh> one = poll(1);
+    std::vector<Refresh> pool = poll(3);
+
+    printf("Refreshes in %u s, largest gap between refreshes\n", duration / 1000);
+    printf("  %-8s %7s %8s %22s %22s\n", "block", "period", "latency", "1 connection", "3 connections");
+    for (size_t b = 0; b < bds.size(); b++)
+    {
+        printf("  %-8s %5ums %6ums %8.2f/s gap %5ums %8.2f/s gap %5ums\n", bds[b]._name, bds[b]._period, latency[b],
+               one[b]._count * 1000.0 / duration, one[b]._max_gap, pool[b]._count * 1000.0 / duration, pool[b]._max_gap);
+        CHECK(pool[b]._count > 0);
+    }
+    // The energy reads hold up the dynamic block on one connection, not on three
+    CHECK(pool[0]._max_gap < one[0]._max_gap);
+    CHECK(pool[0]._max_gap < bds[0]._period + latency[1]);
+    return report("bench_connection_pool");
+}
@@ -0,0 +1,66 @@
+/**
+ * @file      bench_conversion.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Time per EM24 to WattNode conversion: the compiled plan against the hand written conversion
+ */
+
+#include "check.h"
+#include "convert_em24_e1_to_wattnode.h"
+#include "em24_samples.h"
+
+using namespace modbus_gateway;
+
+static ModbusServer rtu;
+static Bus bus(rtu);
+static Server<WattNode> wattnode(bus, 2, 1234);
+static Aggregate<EM24_E1> meter{ArrayView<Aggregate<EM24_E1>::Rule>()};
+
+int main()
+{
+    ConvertEM24_E1ToWattNode converter(meter, wattnode);
+    load(meter, em24Images()[0], 1);
+
+    // Both conversions publish the WattNode values, and the plan only runs for changed blocks, so every
+    // run first marks all meter blocks as new. Both are timed on their own and subtracted.
+    uint32_t transaction = 1;
+    auto arrive = [&]()
+    {
+        DataAccess<Aggregate<EM24_E1>> dataaccess(meter);
+        for (uint32_t b = 0; b < meter._device._dd._bds.size(); b++)
+            dataaccess.setTransaction(b, ++transaction);
+    };
+    const uint32_t n = 20000;
+    double arrival = nsPerCall(n, [&](uint32_t)
+                               { arrive(); });
+    double publication = nsPerCall(n, [&](uint32_t)
+                                   { DataAccess<Server<WattNode>> dataaccess(wattnode);
+                                     dataaccess.publish(); });
+    double plan = nsPerCall(n, [&](uint32_t)
+                            { arrive();
+                              converter.CopyDataFromMasterToSlave(); });
+    std::vector<float> planned;
+    for (uint32_t r = 0; r < WattNode::last; r++)
+        planned.push_back(wattnodeFloat(wattnode, WattNode::e_registers(r)));
+    double hand = nsPerCall(n, [&](uint32_t)
+                            { arrive();
+                              handWrittenConversion(meter, wattnode); });
+
+    printf("Conversion of all rules, ns (without the arrival %.0f ns and the publication %.0f ns)\n", arrival, publication);
+    printf("  hand written: %.0f\n", hand - arrival - publication);
+    printf("  plan:         %.0f\n", plan - arrival - publication);
+
+    // Same results, up to float rounding
+    for (uint32_t r = 0; r < WattNode::last; r++)
+    {
+        const RegisterDescription &rd = wattnode._device._dd.registerDescription(WattNode::e_registers(r));
+        if (rd._dataType != float32)
+            continue;
+        float f = wattnodeFloat(wattnode, WattNode::e_registers(r));
+        CHECK(fabsf(planned[r] - f) <= 1e-6f * fabsf(f));
+    }
+    CHECK(converter.sourceRegisters().size() < 48);
+    return report("bench_conversion");
+}
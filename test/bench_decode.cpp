@@ -0,0 +1,76 @@
+/**
+ * @file      bench_decode.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Reading the values of the EM24 dynamic block by four readers per arrival: decoded once
+ *            when the block arrives against decoded on every read
+ */
+
+#include "check.h"
+#include "em24_samples.h"
+
+using namespace modbus_gateway;
+
+static Aggregate<EM24_E1> meter{ArrayView<Aggregate<EM24_E1>::Rule>()};
+
+// The converter, the aggregate, the event push and the snapshot API each read the block
+static const uint32_t readers = 4;
+
+int main()
+{
+    std::vector<EM24_E1::e_registers> dynamic;
+    for (uint32_t r = 0; r < EM24_E1::last; r++)
+    {
+        if (meter._device._dd._rr[r]._block_idx == 0)
+            dynamic.push_back(EM24_E1::e_registers(r));
+    }
+
+    const uint32_t n = 20000;
+    double once = 0;
+    double every = 0;
+    uint32_t transaction = 1;
+    for (const Image &image : em24Images())
+    {
+        load(meter, image, ++transaction);
+        DataAccess<Aggregate<EM24_E1>> dataaccess(meter);
+        // Decoded once, bit for bit the decoding on read
+        for (uint32_t r = 0; r < EM24_E1::last; r++)
+        {
+            float a = dataaccess.getValue(EM24_E1::e_registers(r));
+            float b = dataaccess.getFloatValue(EM24_E1::e_registers(r));
+            CHECK(memcmp(&a, &b, sizeof(float)) == 0);
+        }
+
+        once += nsPerCall(n, [&](uint32_t)
+                          {
+            dataaccess.setTransaction(0, ++transaction);
+            float sum = 0;
+            for (uint32_t i = 0; i < readers; i++)
+            {
+                for (auto r = dynamic.begin(); r < dynamic.end(); r++)
+                    sum += dataaccess.getValue(*r);
+            }
+            keep(sum); });
+        // setTransaction decodes as well, so the arrival is timed apart and subtracted
+        double arrival = nsPerCall(n, [&](uint32_t)
+                                   { dataaccess.setTransaction(0, ++transaction); });
+        every += nsPerCall(n, [&](uint32_t)
+                           {
+            dataaccess.setTransaction(0, ++transaction);
+            float sum = 0;
+            for (uint32_t i = 0; i < readers; i++)
+            {
+                for (auto r = dynamic.begin(); r < dynamic.end(); r++)
+                    sum += dataaccess.getFloatValue(*r);
+            }
+            keep(sum); }) -
+                 arrival;
+    }
+    const size_t images = em24Images().size();
+    printf("Dynamic block, %u registers, %u readers per arrival, ns per arrival\n", unsigned(dynamic.size()), readers);
+    printf("  decoded on every read: %.0f\n", every / images);
+    printf("  decoded on arrival:    %.0f\n", once / images);
+    return report("bench_decode");
+}
@@ -0,0 +1,83 @@
+/**
+ * @file      bench_ingestion.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Writing received EM24 blocks into the register image: the byte swapping writeRegisters
+ *            against the register by register loop it replaced
+ */
+
+#include "check.h"
+#include "em24_e1.h"
+#include "aggregate.h"
+
+using namespace modbus_gateway;
+
+static Aggregate<EM24_E1> meter{ArrayView<Aggregate<EM24_E1>::Rule>()};
+
+// All blocks as big endian bytes
+static std::vector<uint8_t> readBack(DataAccess<Aggregate<EM24_E1>> &dataaccess)
+{
+    std::vector<uint8_t> r;
+    for (const BlockDescription &bd : meter._device._dd._bds)
+    {
+        std::vector<uint8_t> block(bd._number_reg * 2);
+        dataaccess.readRegisters(bd._offset, bd._number_reg, block.data());
+        r.insert(r.end(), block.begin(), block.end());
+    }
+    return r;
+}
+
+int main()
+{
+    const auto &bds = meter._device._dd._bds;
+    // The payloads of the responses to the reads of all blocks
+    std::vector<std::vector<uint8_t>> payloads;
+    uint32_t bytes = 0;
+    for (size_t b = 0; b < bds.size(); b++)
+    {
+        std::vector<uint8_t> p(bds[b]._number_reg * 2);
+        for (size_t i = 0; i < p.size(); i++)
+            p[i] = uint8_t(b * 31 + i * 7);
+        bytes += p.size();
+        payloads.push_back(p);
+    }
+
+    DataAccess<Aggregate<EM24_E1>> dataaccess(meter);
+    const uint32_t n = 20000;
+    // As the data handler of the client did
+    double loop = nsPerCall(n, [&](uint32_t)
+                            {
+        for (size_t b = 0; b < bds.size(); b++)
+        {
+            const uint8_t *i = payloads[b].data();
+            uint16_t address = bds[b]._offset;
+            for (uint16_t w = 0; w < bds[b]._number_reg; w++)
+            {
+                Value v;
+                v.b2 = *i++;
+                v.b1 = *i++;
+                dataaccess.writeRegister(address++, v.w);
+            }
+        } });
+    std::vector<uint8_t> looped = readBack(dataaccess);
+
+    double swapped = nsPerCall(n, [&](uint32_t)
+                               {
+        for (size_t b = 0; b < bds.size(); b++)
+            dataaccess.writeRegisters(bds[b]._offset, bds[b]._number_reg, payloads[b].data()); });
+    std::vector<uint8_t> written = readBack(dataaccess);
+
+    printf("Writing %u blocks, %u bytes, into the register image, ns (MB/s)\n", unsigned(bds.size()), bytes);
+    printf("  register by register: %.0f (%.0f)\n", loop, bytes * 1000.0 / loop);
+    printf("  writeRegisters:       %.0f (%.0f)\n", swapped, bytes * 1000.0 / swapped);
+
+    // Both read back as sent
+    std::vector<uint8_t> sent;
+    for (size_t b = 0; b < bds.size(); b++)
+        sent.insert(sent.end(), payloads[b].begin(), payloads[b].end());
+    CHECK(looped == sent);
+    CHECK(written == sent);
+    return report("bench_ingestion");
+}
@@ -0,0 +1,121 @@
+/**
+ * @file      bench_snapshot.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Latency of FC03 reads while the converter publishes as fast as it can: the published
+ *            snapshot against reading the register image under the device lock
+ */
+
+// As on the ESP32 the converter and the RTU task run in their own threads; on a host with one core the
+// reader only waits for the lock when the converter is preempted while holding it.
+
+#include <atomic>
+#include <thread>
+#include "check.h"
+#include "server.h"
+#include "wattnode.h"
+
+using namespace modbus_gateway;
+
+static ModbusServer rtu;
+static Bus bus(rtu);
+static Server<WattNode> wattnode(bus, 2, 1234);
+
+static const uint16_t address = 1000;
+
+// Every publication writes its number into all registers of the block, so a read that mixes two
+// publications shows up as different words
+static void convert(std::atomic<bool> &stop, uint32_t &publications)
+{
+    const uint16_t words = wattnode._device._dd._bds[1]._number_reg;
+    std::vector<uint8_t> bytes(words * 2);
+    for (uint16_t n = 1; !stop.load(std::memory_order_relaxed); n++)
+    {
+        for (uint16_t i = 0; i < words; i++)
+        {
+            bytes[2 * i] = n >> 8;
+            bytes[2 * i + 1] = n & 0xff;
+        }
+        DataAccess<Server<WattNode>> dataaccess(wattnode);
+        dataaccess.writeRegisters(address, words, bytes.data());
+        dataaccess.publish();
+        publications++;
+    }
+}
+
+static bool consistent(const uint8_t *frame, uint16_t words)
+{
+    for (uint16_t i = 1; i < words; i++)
+    {
+        if (frame[2 * i] != frame[0] || frame[2 * i + 1] != frame[1])
+            return false;
+    }
+    return true;
+}
+
+struct Result
+{
+    double _p50;
+    double _p99;
+    double _max;
+    // Reads that took over 100 us, mostly waiting for the converter
+    uint32_t _slow;
+    uint32_t _inconsistent;
+    uint32_t _publications;
+};
+
+// read(frame) reads the block into frame
+template <typename READ>
+static Result measure(uint32_t n, READ read)
+{
+    const uint16_t words = wattnode._device._dd._bds[1]._number_reg;
+    std::atomic<bool> stop{false};
+    uint32_t publications = 0;
+    std::thread converter(convert, std::ref(stop), std::ref(publications));
+
+    std::vector<double> us;
+    us.reserve(n);
+    uint32_t inconsistent = 0;
+    uint32_t slow = 0;
+    uint8_t frame[3 + 250];
+    for (uint32_t i = 0; i < n; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        read(frame);
+        us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+        slow += us.back() > 100;
+        inconsistent += !consistent(frame + 3, words);
+    }
+    stop = true;
+    converter.join();
+    return Result{percentile(us, 50), percentile(us, 99), us.back(), slow, inconsistent, publications};
+}
+
+int main()
+{
+    const uint16_t words = wattnode._device._dd._bds[1]._number_reg;
+    ModbusMessage request;
+    request.add(uint8_t(2), uint8_t(READ_HOLD_REGISTER), address, words);
+
+    Result locked = measure(200000, [&](uint8_t *frame)
+                            {
+        DataAccess<Server<WattNode>> dataaccess(wattnode);
+        frame[0] = 2;
+        frame[1] = READ_HOLD_REGISTER;
+        frame[2] = words * 2;
+        dataaccess.readRegisters(address, words, frame + 3); });
+    Result snapshot = measure(200000, [&](uint8_t *frame)
+                              {
+        ModbusMessage response = bus.dispatch(request);
+        memcpy(frame, response.data(), response.size()); });
+
+    printf("FC03 of %u registers while publishing, us\n", words);
+    printf("  device lock: p50=%.2f p99=%.2f max=%.0f over 100us=%u publications=%u\n", locked._p50, locked._p99, locked._max, locked._slow, locked._publications);
+    printf("  snapshot:    p50=%.2f p99=%.2f max=%.0f over 100us=%u publications=%u\n", snapshot._p50, snapshot._p99, snapshot._max, snapshot._slow, snapshot._publications);
+    CHECK(locked._inconsistent == 0);
+    CHECK(snapshot._inconsistent == 0);
+    CHECK(snapshot._publications > 0);
+    return report("bench_snapshot");
+}
@@ -0,0 +1,247 @@
+/**
+ * @file      bench_tcp_front_end.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Load on the Modbus TCP front-end over loopback: parallel clients pipelining FC03 reads, the
+ *            connection limit, the rate limit and malformed frames
+ */
+
+// The front-end is polled every 2 ms by a Task, as in the firmware.
+
+#include <arpa/inet.h>
+#include <thread>
+#include "check.h"
+#include "server.h"
+#include "tasks.h"
+#include "tcp_front_end.h"
+#include "wattnode.h"
+
+using namespace modbus_gateway;
+
+static ModbusServer rtu;
+static Bus bus(rtu);
+static Server<WattNode> wattnode(bus, 2, 1234);
+static BusReader reader(bus);
+
+static const uint16_t port = 15020;
+static const uint16_t limited_port = 15021;
+static const uint16_t clients = 8;
+
+static int connectTo(uint16_t p)
+{
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in a{};
+    a.sin_family = AF_INET;
+    a.sin_port = htons(p);
+    a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, (sockaddr *)&a, sizeof(a)) != 0)
+    {
+        ::close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    timeval timeout{5, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+static bool sendRead(int fd, uint16_t transaction, uint8_t id, uint16_t address, uint16_t words)
+{
+    uint8_t frame[12] = {uint8_t(transaction >> 8), uint8_t(transaction), 0, 0, 0, 6, id, READ_HOLD_REGISTER,
+                         uint8_t(address >> 8), uint8_t(address), uint8_t(words >> 8), uint8_t(words)};
+    return ::send(fd, frame, sizeof(frame), 0) == sizeof(frame);
+}
+
+// One response: transaction ID and PDU with the unit ID in front. False when the connection closed.
+static bool receive(int fd, uint16_t &transaction, std::vector<uint8_t> &pdu)
+{
+    auto all = [fd](uint8_t *p, size_t n)
+    {
+        while (n > 0)
+        {
+            ssize_t r = ::recv(fd, p, n, 0);
+            if (r <= 0)
+                return false;
+            p += r;
+            n -= r;
+        }
+        return true;
+    };
+    uint8_t header[6];
+    if (!all(header, 6))
+        return false;
+    transaction = (header[0] << 8) | header[1];
+    pdu.resize((header[4] << 8) | header[5]);
+    return all(pdu.data(), pdu.size());
+}
+
+struct Load
+{
+    uint32_t _answered = 0;
+    uint32_t _wrong = 0;
+    std::vector<double> _us;
+};
+
+// Keeps window reads in flight on one connection
+static void client(uint32_t requests, uint16_t window, Load &load)
+{
+    const uint16_t words = wattnode._device._dd._bds[1]._number_reg;
+    const uint16_t address = wattnode._device._dd._bds[1]._offset;
+    int fd = connectTo(port);
+    if (fd < 0)
+    {
+        load._wrong = requests;
+        return;
+    }
+    std::vector<std::chrono::steady_clock::time_point> sent(requests);
+    uint32_t next = 0;
+    std::vector<uint8_t> pdu;
+    while (load._answered + load._wrong < requests)
+    {
+        while (next < requests && next - (load._answered + load._wrong) < window)
+        {
+            sent[next] = std::chrono::steady_clock::now();
+            sendRead(fd, next, 2, address, words);
+            next++;
+        }
+        uint16_t transaction;
+        if (!receive(fd, transaction, pdu))
+        {
+            load._wrong += next - (load._answered + load._wrong);
+            break;
+        }
+        load._us.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - sent[transaction]).count());
+        if (pdu.size() == 3u + 2 * words && pdu[0] == 2 && pdu[1] == READ_HOLD_REGISTER && pdu[2] == 2 * words)
+            load._answered++;
+        else
+            load._wrong++;
+    }
+    ::close(fd);
+}
+
+static void parallelClients(TcpFrontEnd<BusReader> &frontEnd)
+{
+    const uint32_t requests = 2000;
+    std::vector<Load> loads(clients);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (uint16_t i = 0; i < clients; i++)
+        threads.emplace_back(client, requests, 4, std::ref(loads[i]));
+    for (auto &t : threads)
+        t.join();
+    double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<double> us;
+    uint32_t answered = 0;
+    uint32_t wrong = 0;
+    for (const Load &l : loads)
+    {
+        answered += l._answered;
+        wrong += l._wrong;
+        us.insert(us.end(), l._us.begin(), l._us.end());
+    }
+    printf("%u connections pipelining 4 FC03 reads each, polled every 2 ms\n", clients);
+    printf("  %u answered in %.2f s: %.0f requests/s, p50=%.0f us p99=%.0f us\n", answered, s, answered / s, percentile(us, 50), percentile(us, 99));
+    CHECK(answered == clients * requests);
+    CHECK(wrong == 0);
+}
+
+// CLIENTS connections are served, one more is accepted and closed at once
+static void connectionLimit()
+{
+    // A few polls, so the front-end sees that the earlier connections closed
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    std::vector<int> fds;
+    for (uint16_t i = 0; i < clients + 1; i++)
+        fds.push_back(connectTo(port));
+    const uint16_t address = wattnode._device._dd._bds[1]._offset;
+    uint32_t served = 0;
+    uint32_t closed = 0;
+    for (int fd : fds)
+    {
+        uint16_t transaction;
+        std::vector<uint8_t> pdu;
+        if (fd >= 0 && sendRead(fd, 7, 2, address, 1) && receive(fd, transaction, pdu))
+            served += transaction == 7;
+        else
+            closed++;
+        ::close(fd);
+    }
+    CHECK(served == clients);
+    CHECK(closed == 1);
+}
+
+// Past the burst a connection gets SERVER_DEVICE_BUSY
+static void rateLimit()
+{
+    int fd = connectTo(limited_port);
+    CHECK(fd >= 0);
+    const uint16_t address = wattnode._device._dd._bds[1]._offset;
+    for (uint16_t i = 0; i < 100; i++)
+        sendRead(fd, i, 2, address, 1);
+    uint32_t busy = 0;
+    uint32_t answered = 0;
+    std::vector<uint8_t> pdu;
+    for (uint16_t i = 0; i < 100; i++)
+    {
+        uint16_t transaction;
+        if (!receive(fd, transaction, pdu))
+            break;
+        CHECK(transaction == i);
+        if (pdu[1] == (READ_HOLD_REGISTER | 0x80) && pdu[2] == SERVER_DEVICE_BUSY)
+            busy++;
+        else
+            answered++;
+    }
+    printf("Rate limit 20/s, burst 40: 100 requests at once, %u answered, %u busy\n", answered, busy);
+    CHECK(answered >= 40 && answered < 50);
+    CHECK(answered + busy == 100);
+    ::close(fd);
+}
+
+// A frame that is not Modbus closes the connection, unit IDs without a slave get an error
+static void malformed()
+{
+    int fd = connectTo(port);
+    uint8_t frame[12] = {0, 1, 0, 5, 0, 6, 2, READ_HOLD_REGISTER, 0, 0, 0, 1};
+    ::send(fd, frame, sizeof(frame), 0);
+    uint16_t transaction;
+    std::vector<uint8_t> pdu;
+    CHECK(!receive(fd, transaction, pdu));
+    ::close(fd);
+
+    fd = connectTo(port);
+    sendRead(fd, 3, 9, 0, 1);
+    CHECK(receive(fd, transaction, pdu));
+    CHECK(pdu.size() == 3 && pdu[1] == (READ_HOLD_REGISTER | 0x80) && pdu[2] == GATEWAY_TARGET_NO_RESP);
+    ::close(fd);
+}
+
+int main()
+{
+    TcpLimits unlimited;
+    unlimited._rate = 60000;
+    unlimited._burst = 60000;
+    TcpFrontEnd<BusReader> frontEnd(reader, unlimited);
+    frontEnd.begin(port);
+    TcpLimits limits;
+    TcpFrontEnd<BusReader> limited(reader, limits);
+    limited.begin(limited_port);
+    Task task("tcp", 4096, 1, 0, [&]
+              { uint32_t now = millis();
+                frontEnd.poll(now);
+                limited.poll(now);
+                return 2u; });
+    task.start();
+
+    parallelClients(frontEnd);
+    connectionLimit();
+    rateLimit();
+    malformed();
+    task.stop();
+    printf("  %s", frontEnd.allValuesAsString().c_str());
+    return report("bench_tcp_front_end");
+}
@@ -0,0 +1,66 @@
+/**
+ * @file      check.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Checks and timing for the host tests and benchmarks
+ */
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// A failed CHECK is reported and makes the test fail, the test goes on
+inline int failures = 0;
+#define CHECK(condition)                                                        \
+    do                                                                          \
+    {                                                                           \
+        if (!(condition))                                                       \
+        {                                                                       \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                         \
+        }                                                                       \
+    } while (0)
+
+// The exit code of the test
+inline int report(const char *name)
+{
+    printf("%s: %s\n", name, failures == 0 ? "passed" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
+
+// ns per call of f, the best of a few rounds of n calls
+template <typename F>
+double nsPerCall(uint32_t n, F f)
+{
+    double best = 1e30;
+    for (int round = 0; round < 5; round++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        for (uint32_t i = 0; i < n; i++)
+            f(i);
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+        best = std::min(best, ns);
+    }
+    return best;
+}
+
+// Percentile p (0-100) of the samples, which are sorted
+template <typename T>
+T percentile(std::vector<T> &samples, double p)
+{
+    if (samples.empty())
+        return T();
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, size_t(samples.size() * p / 100))];
+}
+
+// Keeps the compiler from optimizing a benchmarked result away
+template <typename T>
+void keep(const T &value)
+{
+    asm volatile("" : : "g"(&value) : "memory");
+}
@@ -0,0 +1,157 @@
+/**
+ * @file      em24_samples.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      EM24 register images for the host tests, and the conversion as it was written by hand
+ */
+#pragma once
+
+#include <vector>
+#include "aggregate.h"
+#include "em24_e1.h"
+#include "server.h"
+#include "wattnode.h"
+
+namespace modbus_gateway
+{
+    // A register with its value as the meter sends it: scaled, e.g. 2301 for 230.1 V
+    struct Sample
+    {
+        EM24_E1::e_registers _register;
+        int64_t _raw;
+    };
+    struct Image
+    {
+        const char *_name;
+        std::vector<Sample> _samples;
+    };
+
+    // Registers that are not listed are 0
+    inline const std::vector<Image> &em24Images()
+    {
+        static const std::vector<Image> images = {
+            {"importing",
+             {{EM24_E1::l1_voltage, 2301}, {EM24_E1::l2_voltage, 2318}, {EM24_E1::l3_voltage, 2296},
+              {EM24_E1::l12_voltage, 3992}, {EM24_E1::l23_voltage, 4003}, {EM24_E1::l31_voltage, 3987},
+              {EM24_E1::l1_current, 5123}, {EM24_E1::l2_current, 1207}, {EM24_E1::l3_current, 9874},
+              {EM24_E1::l1_power_active, 11784}, {EM24_E1::l2_power_active, 2641}, {EM24_E1::l3_power_active, 22607},
+              {EM24_E1::l1_power_apparent, 11788}, {EM24_E1::l2_power_apparent, 2798}, {EM24_E1::l3_power_apparent, 22670},
+              {EM24_E1::l1_power_reactive, 301}, {EM24_E1::l2_power_reactive, -912}, {EM24_E1::l3_power_reactive, 1688},
+              {EM24_E1::voltage_ln, 2305}, {EM24_E1::voltage_ll, 3994}, {EM24_E1::power_active, 37032},
+              {EM24_E1::power_apparent, 37256}, {EM24_E1::power_reactive, 1077},
+              {EM24_E1::l1_power_factor, 999}, {EM24_E1::l2_power_factor, 943}, {EM24_E1::l3_power_factor, 997},
+              {EM24_E1::total_pf, 994}, {EM24_E1::frequency, 500},
+              {EM24_E1::import_energy_active, 123456}, {EM24_E1::import_energy_reactive, 20417},
+              {EM24_E1::demand_power_active, 35120}, {EM24_E1::maximum_demand_power_active, 91877},
+              {EM24_E1::l1_import_energy_active, 41003}, {EM24_E1::l2_import_energy_active, 30221},
+              {EM24_E1::l3_import_energy_active, 52232}, {EM24_E1::export_energy_active, 23456},
+              {EM24_E1::export_energy_reactive, 1021}, {EM24_E1::demand_power_apparent, 35544}}},
+            // Negative power factors and powers, so integer conversions have a negative remainder
+            {"exporting",
+             {{EM24_E1::l1_voltage, 2412}, {EM24_E1::l2_voltage, 2409}, {EM24_E1::l3_voltage, 2415},
+              {EM24_E1::l1_current, 10877}, {EM24_E1::l2_current, 10902}, {EM24_E1::l3_current, 10850},
+              {EM24_E1::l1_power_active, -26003}, {EM24_E1::l2_power_active, -25987}, {EM24_E1::l3_power_active, -25911},
+              {EM24_E1::l1_power_reactive, -2817}, {EM24_E1::l2_power_reactive, -3001}, {EM24_E1::l3_power_reactive, -2699},
+              {EM24_E1::voltage_ln, 2412}, {EM24_E1::power_active, -77901}, {EM24_E1::power_reactive, -8517},
+              {EM24_E1::l1_power_factor, -954}, {EM24_E1::l2_power_factor, -501}, {EM24_E1::l3_power_factor, -1},
+              {EM24_E1::total_pf, -876}, {EM24_E1::frequency, 501},
+              {EM24_E1::import_energy_active, 123457}, {EM24_E1::export_energy_active, 23461},
+              {EM24_E1::l1_import_energy_active, 41003}, {EM24_E1::l2_import_energy_active, 30222},
+              {EM24_E1::l3_import_energy_active, 52232}, {EM24_E1::demand_power_active, -70338}}},
+            // Energy totals over 2^24, beyond what a float holds exactly
+            {"large counters",
+             {{EM24_E1::import_energy_active, 98765432}, {EM24_E1::export_energy_active, 34567891},
+              {EM24_E1::import_energy_reactive, 16777217}, {EM24_E1::export_energy_reactive, 16777219},
+              {EM24_E1::l1_import_energy_active, 33333333}, {EM24_E1::l2_import_energy_active, 32922100},
+              {EM24_E1::l3_import_energy_active, 32509999}, {EM24_E1::total_pf, -1000},
+              {EM24_E1::maximum_demand_power_active, 2147483647}, {EM24_E1::power_active, -2147483647}}},
+            {"nearly zero",
+             {{EM24_E1::export_energy_active, 1}, {EM24_E1::l1_import_energy_active, 2},
+              {EM24_E1::l1_power_active, -1}, {EM24_E1::l2_power_factor, -1}, {EM24_E1::l3_current, 1}}},
+        };
+        return images;
+    }
+
+    // Store an image in the meter as if every block just arrived
+    inline void load(Aggregate<EM24_E1> &meter, const Image &image, uint32_t transaction)
+    {
+        DataAccess<Aggregate<EM24_E1>> dataaccess(meter);
+        uint16_t *registers = dataaccess.image();
+        for (uint32_t r = 0; r < EM24_E1::last; r++)
+            meter._device._dd.registerDescription(EM24_E1::e_registers(r)).setInteger(&registers[meter._device.registerIndex(EM24_E1::e_registers(r))], 0);
+        for (const Sample &s : image._samples)
+            meter._device._dd.registerDescription(s._register).setInteger(&registers[meter._device.registerIndex(s._register)], s._raw);
+        for (uint32_t b = 0; b < meter._device._dd._bds.size(); b++)
+            dataaccess.setTransaction(b, transaction);
+    }
+
+    // A WattNode float32 register as stored by the conversion
+    inline float wattnodeFloat(Server<WattNode> &wattnode, WattNode::e_registers r)
+    {
+        DataAccess<Server<WattNode>> dataaccess(wattnode);
+        const uint16_t *registers = dataaccess.image();
+        Value v;
+        v.w1 = registers[wattnode._device.registerIndex(r)];
+        v.w2 = registers[wattnode._device.registerIndex(r) + 1];
+        return v.f32;
+    }
+
+    // The conversion as it was before it was compiled into a plan: every value through getFloatValue
+    inline void handWrittenConversion(Aggregate<EM24_E1> &m, Server<WattNode> &w)
+    {
+        DataAccess<Server<WattNode>> wattnode(w);
+        DataAccess<Aggregate<EM24_E1>> meter(m);
+        // Block 1000
+        wattnode.setFloatValue(WattNode::energy_active, meter.getFloatValue(EM24_E1::import_energy_active) + meter.getFloatValue(EM24_E1::export_energy_active));
+        wattnode.setFloatValue(WattNode::import_energy_active, meter.getFloatValue(EM24_E1::import_energy_active));
+        wattnode.setFloatValue(WattNode::energy_active_nr, meter.getFloatValue(EM24_E1::import_energy_active) + meter.getFloatValue(EM24_E1::export_energy_active));
+        wattnode.setFloatValue(WattNode::import_energy_active_nr, meter.getFloatValue(EM24_E1::import_energy_active));
+        wattnode.setFloatValue(WattNode::power_active, meter.getFloatValue(EM24_E1::power_active));
+        wattnode.setFloatValue(WattNode::l1_power_active, meter.getFloatValue(EM24_E1::l1_power_active));
+        wattnode.setFloatValue(WattNode::l2_power_active, meter.getFloatValue(EM24_E1::l2_power_active));
+        wattnode.setFloatValue(WattNode::l3_power_active, meter.getFloatValue(EM24_E1::l3_power_active));
+        wattnode.setFloatValue(WattNode::voltage_ln, meter.getFloatValue(EM24_E1::voltage_ln));
+        wattnode.setFloatValue(WattNode::l1n_voltage, meter.getFloatValue(EM24_E1::l1_voltage));
+        wattnode.setFloatValue(WattNode::l2n_voltage, meter.getFloatValue(EM24_E1::l2_voltage));
+        wattnode.setFloatValue(WattNode::l3n_voltage, meter.getFloatValue(EM24_E1::l3_voltage));
+        wattnode.setFloatValue(WattNode::voltage_ll, meter.getFloatValue(EM24_E1::voltage_ll));
+        wattnode.setFloatValue(WattNode::l12_voltage, meter.getFloatValue(EM24_E1::l12_voltage));
+        wattnode.setFloatValue(WattNode::l23_voltage, meter.getFloatValue(EM24_E1::l23_voltage));
+        wattnode.setFloatValue(WattNode::l31_voltage, meter.getFloatValue(EM24_E1::l31_voltage));
+        wattnode.setFloatValue(WattNode::frequency, meter.getFloatValue(EM24_E1::frequency));
+        // Block 1100
+        wattnode.setFloatValue(WattNode::l1_energy_active, meter.getFloatValue(EM24_E1::l1_import_energy_active) + meter.getFloatValue(EM24_E1::export_energy_active) / 3);
+        wattnode.setFloatValue(WattNode::l2_energy_active, meter.getFloatValue(EM24_E1::l2_import_energy_active) + meter.getFloatValue(EM24_E1::export_energy_active) / 3);
+        wattnode.setFloatValue(WattNode::l3_energy_active, meter.getFloatValue(EM24_E1::l3_import_energy_active) + meter.getFloatValue(EM24_E1::export_energy_active) / 3);
+        wattnode.setFloatValue(WattNode::l1_import_energy_active, meter.getFloatValue(EM24_E1::l1_import_energy_active));
+        wattnode.setFloatValue(WattNode::l2_import_energy_active, meter.getFloatValue(EM24_E1::l2_import_energy_active));
+        wattnode.setFloatValue(WattNode::l3_import_energy_active, meter.getFloatValue(EM24_E1::l3_import_energy_active));
+        wattnode.setFloatValue(WattNode::export_energy_active, meter.getFloatValue(EM24_E1::export_energy_active));
+        wattnode.setFloatValue(WattNode::export_energy_active_nr, meter.getFloatValue(EM24_E1::export_energy_active));
+        wattnode.setFloatValue(WattNode::l1_export_energy_active, meter.getFloatValue(EM24_E1::export_energy_active) / 3);
+        wattnode.setFloatValue(WattNode::l2_export_energy_active, meter.getFloatValue(EM24_E1::export_energy_active) / 3);
+        wattnode.setFloatValue(WattNode::l3_export_energy_active, meter.getFloatValue(EM24_E1::export_energy_active) / 3);
+        wattnode.setFloatValue(WattNode::energy_reactive, meter.getFloatValue(EM24_E1::import_energy_reactive) + meter.getFloatValue(EM24_E1::export_energy_reactive));
+        wattnode.setFloatValue(WattNode::power_factor, meter.getFloatValue(EM24_E1::total_pf));
+        wattnode.setFloatValue(WattNode::l1_power_factor, meter.getFloatValue(EM24_E1::l1_power_factor));
+        wattnode.setFloatValue(WattNode::l2_power_factor, meter.getFloatValue(EM24_E1::l2_power_factor));
+        wattnode.setFloatValue(WattNode::l3_power_factor, meter.getFloatValue(EM24_E1::l3_power_factor));
+        wattnode.setFloatValue(WattNode::power_reactive, meter.getFloatValue(EM24_E1::power_reactive));
+        wattnode.setFloatValue(WattNode::l1_power_reactive, meter.getFloatValue(EM24_E1::l1_power_reactive));
+        wattnode.setFloatValue(WattNode::l2_power_reactive, meter.getFloatValue(EM24_E1::l2_power_reactive));
+        wattnode.setFloatValue(WattNode::l3_power_reactive, meter.getFloatValue(EM24_E1::l3_power_reactive));
+        wattnode.setFloatValue(WattNode::power_apparent, meter.getFloatValue(EM24_E1::power_apparent));
+        wattnode.setFloatValue(WattNode::l1_power_apparent, meter.getFloatValue(EM24_E1::l1_power_apparent));
+        wattnode.setFloatValue(WattNode::l2_power_apparent, meter.getFloatValue(EM24_E1::l2_power_apparent));
+        wattnode.setFloatValue(WattNode::l3_power_apparent, meter.getFloatValue(EM24_E1::l3_power_apparent));
+        wattnode.setFloatValue(WattNode::l1_current, meter.getFloatValue(EM24_E1::l1_current));
+        wattnode.setFloatValue(WattNode::l2_current, meter.getFloatValue(EM24_E1::l2_current));
+        wattnode.setFloatValue(WattNode::l3_current, meter.getFloatValue(EM24_E1::l3_current));
+        wattnode.setFloatValue(WattNode::demand_power_active, meter.getFloatValue(EM24_E1::demand_power_active));
+        wattnode.setFloatValue(WattNode::maximum_demand_power_active, meter.getFloatValue(EM24_E1::maximum_demand_power_active));
+        wattnode.setFloatValue(WattNode::demand_power_apparent, meter.getFloatValue(EM24_E1::demand_power_apparent));
+        wattnode.publish();
+    }
+}
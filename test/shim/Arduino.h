@@ -0,0 +1,114 @@
+/**
+ * @file      Arduino.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      The part of the Arduino core the gateway headers use, for the host tests
+ */
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include <string>
+#include <functional>
+
+// ARDUINO is not defined, so tasks.h uses its std::thread implementation
+
+class String
+{
+public:
+    String() {}
+    String(const char *s) : _s(s ? s : "") {}
+    String(const std::string &s) : _s(s) {}
+    explicit String(int v) : _s(std::to_string(v)) {}
+    explicit String(unsigned v) : _s(std::to_string(v)) {}
+    explicit String(long v) : _s(std::to_string(v)) {}
+    explicit String(unsigned long v) : _s(std::to_string(v)) {}
+    const char *c_str() const { return _s.c_str(); }
+    unsigned length() const { return _s.size(); }
+    bool reserve(unsigned n)
+    {
+        _s.reserve(n);
+        return true;
+    }
+    String &operator+=(const String &o)
+    {
+        _s += o._s;
+        return *this;
+    }
+    String &operator+=(const char *o)
+    {
+        _s += o;
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        _s += c;
+        return *this;
+    }
+    bool operator==(const String &o) const { return _s == o._s; }
+    bool operator==(const char *o) const { return _s == o; }
+    bool operator!=(const String &o) const { return _s != o._s; }
+    friend String operator+(const String &a, const String &b) { return String(a._s + b._s); }
+    friend String operator+(const String &a, const char *b) { return String(a._s + b); }
+    friend String operator+(const char *a, const String &b) { return String(a + b._s); }
+    int indexOf(const char *s) const
+    {
+        auto p = _s.find(s);
+        return p == std::string::npos ? -1 : int(p);
+    }
+
+private:
+    std::string _s;
+};
+
+// Output is dropped, the tests print their own results
+class Print
+{
+public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t) { return 1; }
+    virtual size_t write(const uint8_t *, size_t n) { return n; }
+    size_t printf(const char *, ...) { return 0; }
+    size_t print(const String &) { return 0; }
+    size_t print(const char *) { return 0; }
+    size_t println(const String &) { return 0; }
+    size_t println(const char *) { return 0; }
+};
+class Stream : public Print
+{
+public:
+    virtual int available() { return 0; }
+    virtual int read() { return -1; }
+};
+class HardwareSerial : public Stream
+{
+};
+extern HardwareSerial Serial;
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+void yield();
+void *ps_malloc(size_t size);
+
+class IPAddress
+{
+public:
+    IPAddress() {}
+    IPAddress(uint8_t, uint8_t, uint8_t, uint8_t) {}
+    bool fromString(const char *) { return true; }
+};
+
+class Client : public Stream
+{
+public:
+    virtual int connect(IPAddress, uint16_t) { return 0; }
+    virtual uint8_t connected() { return 0; }
+    virtual void stop() {}
+};
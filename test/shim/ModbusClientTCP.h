@@ -0,0 +1,83 @@
+/**
+ * @file      ModbusClientTCP.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      eModbus ModbusClientTCP, for the host tests
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <deque>
+#include <functional>
+#include "ModbusMessage.h"
+
+using MBOnData = std::function<void(ModbusMessage msg, uint32_t token)>;
+using MBOnError = std::function<void(Error error, uint32_t token)>;
+
+// Nothing is sent: the requests are queued, and a test plays the meter by answering them with respond()
+// or fail(), which call the handlers like the eModbus task does.
+class ModbusClientTCP
+{
+public:
+    struct Request
+    {
+        uint32_t _token;
+        uint8_t _id;
+        uint8_t _fc;
+        uint16_t _address;
+        uint16_t _words;
+    };
+
+    explicit ModbusClientTCP(Client &, uint16_t queueLimit = 100) : _limit(queueLimit) {}
+    bool onDataHandler(MBOnData handler)
+    {
+        _data = handler;
+        return true;
+    }
+    bool onErrorHandler(MBOnError handler)
+    {
+        _error = handler;
+        return true;
+    }
+    void begin(int = -1) {}
+    void setTimeout(uint32_t = 2000, uint32_t = 10) {}
+    bool setTarget(IPAddress, uint16_t, uint32_t = 0, uint32_t = 0) { return true; }
+    Error addRequest(uint32_t token, uint8_t id, uint8_t fc, uint16_t address, uint16_t words)
+    {
+        if (_queue.size() >= _limit)
+            return REQUEST_QUEUE_FULL;
+        _queue.push_back(Request{token, id, fc, address, words});
+        return SUCCESS;
+    }
+    uint32_t pendingRequests() { return _queue.size(); }
+
+    // Answer the oldest request with value(address) for every register
+    template <typename VALUE>
+    void respond(VALUE value)
+    {
+        Request r = _queue.front();
+        _queue.pop_front();
+        ModbusMessage m;
+        m.add(r._id, r._fc, uint8_t(r._words * 2));
+        for (uint16_t i = 0; i < r._words; i++)
+            m.add(uint16_t(value(r._address + i)));
+        _data(m, r._token);
+    }
+    void fail(Error e)
+    {
+        Request r = _queue.front();
+        _queue.pop_front();
+        _error(e, r._token);
+    }
+    // Lose the oldest request without a callback
+    void drop() { _queue.pop_front(); }
+
+    std::deque<Request> _queue;
+
+private:
+    uint16_t _limit;
+    MBOnData _data;
+    MBOnError _error;
+};
@@ -0,0 +1,23 @@
+/**
+ * @file      ModbusError.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      eModbus ModbusError, for the host tests
+ */
+#pragma once
+
+#include "ModbusTypes.h"
+
+class ModbusError
+{
+public:
+    ModbusError(Error e) : _e(e) {}
+    operator Error() const { return _e; }
+    operator int() const { return _e; }
+    operator const char *() const { return "error"; }
+
+private:
+    Error _e;
+};
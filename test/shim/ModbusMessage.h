@@ -0,0 +1,58 @@
+/**
+ * @file      ModbusMessage.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      eModbus ModbusMessage, for the host tests
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "ModbusTypes.h"
+
+// The bytes of a Modbus PDU with the server ID in front, as in eModbus. Values are added and read
+// big endian.
+class ModbusMessage
+{
+public:
+    ModbusMessage() = default;
+    ModbusMessage(std::vector<uint8_t> data) : _data(data) {}
+    bool operator==(const ModbusMessage &o) const { return _data == o._data; }
+    const uint8_t *data() const { return _data.data(); }
+    uint16_t size() const { return _data.size(); }
+    uint8_t getServerID() const { return _data.empty() ? 0 : _data[0]; }
+    uint8_t getFunctionCode() const { return _data.size() < 2 ? 0 : _data[1]; }
+    uint8_t operator[](uint16_t i) const { return _data[i]; }
+    void setError(uint8_t id, uint8_t fc, Error e) { _data = {id, uint8_t(fc | 0x80), e}; }
+    uint16_t add(const uint8_t *bytes, uint16_t count)
+    {
+        _data.insert(_data.end(), bytes, bytes + count);
+        return size();
+    }
+    template <class T>
+    uint16_t add(T v)
+    {
+        for (int i = sizeof(T) - 1; i >= 0; --i)
+            _data.push_back((v >> (i * 8)) & 0xff);
+        return size();
+    }
+    template <class T, class... Args>
+    uint16_t add(T v, Args... args)
+    {
+        add(v);
+        return add(args...);
+    }
+    template <typename T>
+    uint16_t get(uint16_t index, T &v) const
+    {
+        v = 0;
+        for (size_t i = 0; i < sizeof(T); ++i)
+            v = (v << 8) | _data[index + i];
+        return index + sizeof(T);
+    }
+
+private:
+    std::vector<uint8_t> _data;
+};
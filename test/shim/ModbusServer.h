@@ -0,0 +1,27 @@
+/**
+ * @file      ModbusServer.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      eModbus ModbusServer, for the host tests
+ */
+#pragma once
+
+#include <functional>
+#include "ModbusMessage.h"
+
+#define ANY_SERVER 0x00
+const ModbusMessage NIL_RESPONSE(std::vector<uint8_t>{0xFF, 0xF1});
+using MBSworker = std::function<ModbusMessage(ModbusMessage msg)>;
+
+// Keeps the registered worker, so a test can hand it requests as the RTU task would
+class ModbusServer
+{
+public:
+    void registerWorker(uint8_t, uint8_t, MBSworker worker) { _worker = worker; }
+    ModbusMessage request(const ModbusMessage &m) { return _worker(m); }
+
+private:
+    MBSworker _worker;
+};
@@ -0,0 +1,34 @@
+/**
+ * @file      ModbusTypes.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      The eModbus error and function codes the gateway uses, for the host tests
+ */
+#pragma once
+
+#include <cstdint>
+
+enum Error : uint8_t
+{
+    SUCCESS = 0x00,
+    ILLEGAL_FUNCTION = 0x01,
+    ILLEGAL_DATA_ADDRESS = 0x02,
+    ILLEGAL_DATA_VALUE = 0x03,
+    SERVER_DEVICE_FAILURE = 0x04,
+    SERVER_DEVICE_BUSY = 0x06,
+    GATEWAY_TARGET_NO_RESP = 0x0B,
+    TIMEOUT = 0xE0,
+    REQUEST_QUEUE_FULL = 0xE7,
+    UNDEFINED_ERROR = 0xFF
+};
+
+enum FunctionCode : uint8_t
+{
+    ANY_FUNCTION_CODE = 0x00,
+    READ_HOLD_REGISTER = 0x03,
+    READ_INPUT_REGISTER = 0x04,
+    WRITE_HOLD_REGISTER = 0x06,
+    WRITE_MULT_REGISTERS = 0x10
+};
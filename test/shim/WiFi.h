@@ -0,0 +1,50 @@
+/**
+ * @file      WiFi.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      A non-blocking WiFiServer on a Linux socket, for the host tests
+ */
+#pragma once
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include "WiFiClient.h"
+
+class WiFiServer
+{
+public:
+    WiFiServer(uint16_t port = 80, uint8_t = 4) : _port(port) {}
+    void begin(uint16_t port = 0)
+    {
+        if (port != 0)
+            _port = port;
+        _fd = ::socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sockaddr_in a{};
+        a.sin_family = AF_INET;
+        a.sin_port = htons(_port);
+        a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        bind(_fd, (sockaddr *)&a, sizeof(a));
+        listen(_fd, 128);
+        fcntl(_fd, F_SETFL, O_NONBLOCK);
+    }
+    void setNoDelay(bool) {}
+    WiFiClient available()
+    {
+        int c = ::accept(_fd, nullptr, nullptr);
+        if (c < 0)
+            return WiFiClient();
+        int one = 1;
+        setsockopt(c, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return WiFiClient(c);
+    }
+
+private:
+    uint16_t _port;
+    int _fd = -1;
+};
@@ -0,0 +1,31 @@
+/**
+ * @file      WiFiClient.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      A WiFiClient on a Linux socket, for the host tests
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <unistd.h>
+
+class WiFiClient : public Client
+{
+public:
+    WiFiClient() {}
+    explicit WiFiClient(int fd) : _fd(fd) {}
+    int fd() const { return _fd; }
+    void setNoDelay(bool) {}
+    void stop() override
+    {
+        if (_fd >= 0)
+            ::close(_fd);
+        _fd = -1;
+    }
+    explicit operator bool() const { return _fd >= 0; }
+
+private:
+    int _fd = -1;
+};
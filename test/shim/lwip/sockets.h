@@ -0,0 +1,12 @@
+/**
+ * @file      sockets.h
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      lwIP sockets are BSD sockets, for the host tests
+ */
+#pragma once
+
+#include <errno.h>
+#include <sys/socket.h>
@@ -0,0 +1,63 @@
+/**
+ * @file      test_aggregate.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      The arrivals listed by the aggregate while another thread updates it
+ */
+
+#include <WiFiClient.h>
+#include <atomic>
+#include <thread>
+#include "aggregate.h"
+#include "check.h"
+#include "em24_e1.h"
+
+using namespace modbus_gateway;
+
+static WiFiClient connection;
+static ModbusClientTCP tcp(connection, modbus_gateway::Client<EM24_E1>::queue_limit);
+static modbus_gateway::Client<EM24_E1> meter(tcp, IPAddress(), 502, 1);
+static Aggregate<EM24_E1> aggregate{ArrayView<Aggregate<EM24_E1>::Rule>()};
+
+// A response of the meter for every block
+static void arrive(uint32_t transaction)
+{
+    DataAccess<modbus_gateway::Client<EM24_E1>> dataaccess(meter);
+    for (uint32_t b = 0; b < meter._device._dd._bds.size(); b++)
+        dataaccess.setTransaction(b, transaction);
+}
+
+int main()
+{
+    aggregate.add(meter);
+    CHECK(aggregate.allValuesAsString(0) == "Aggregate: meters=1, updates=0\r\n  meter 0: dynamic=- energy=- time=- tariff=-\r\n");
+    arrive(1);
+    CHECK(aggregate.update(1000));
+    CHECK(aggregate.allValuesAsString(1000) == "Aggregate: meters=1, updates=1\r\n  meter 0: dynamic=0ms energy=0ms time=0ms tariff=0ms\r\n");
+    CHECK(aggregate.allValuesAsString(3000).indexOf("dynamic=2000ms stale energy=2000ms time") > 0);
+
+    // Listing while the values keep arriving: no wait for a lock that is never released, and every
+    // listing shows the arrivals of a single update
+    std::atomic<bool> stop{false};
+    std::thread updater([&]
+                        {
+        for (uint32_t t = 2; !stop; t++)
+        {
+            arrive(t);
+            aggregate.update(1000 + t);
+        } });
+    uint32_t torn = 0;
+    for (int n = 0; n < 2000; n++)
+    {
+        String r = aggregate.allValuesAsString(0xffffffff);
+        const char *dynamic = strstr(r.c_str(), "dynamic=");
+        const char *tariff = strstr(r.c_str(), "tariff=");
+        torn += dynamic == nullptr || tariff == nullptr || atol(dynamic + 8) != atol(tariff + 7);
+    }
+    stop = true;
+    updater.join();
+    CHECK(torn == 0);
+    return report("test_aggregate");
+}
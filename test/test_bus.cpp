@@ -0,0 +1,126 @@
+/**
+ * @file      test_bus.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      Several virtual slaves on one RTU bus: every request reaches the slave with its ID, requests
+ *            for other IDs get no response, and the dispatch costs the same for one or more slaves
+ */
+
+#include "check.h"
+#include "server.h"
+#include "wattnode.h"
+
+using namespace modbus_gateway;
+
+static ModbusServer rtu;
+static Bus bus(rtu);
+static Server<WattNode> wattnode2(bus, 2, 1002);
+static Server<WattNode> wattnode3(bus, 3, 1003);
+static Server<WattNode> wattnode4(bus, 4, 1004);
+static Server<WattNode> wattnode5(bus, 5, 1005);
+
+static ModbusServer single_rtu;
+static Bus single(single_rtu);
+static Server<WattNode> only(single, 2, 1002);
+
+static const uint16_t modbus_address = WattNode::getDeviceDescription().registerDescription(WattNode::modbus_address)._offset;
+static const uint16_t message_delay = WattNode::getDeviceDescription().registerDescription(WattNode::message_delay)._offset;
+
+static ModbusMessage read(ModbusServer &server, uint8_t id, uint16_t address, uint16_t words)
+{
+    ModbusMessage request;
+    request.add(id, uint8_t(READ_HOLD_REGISTER), address, words);
+    return server.request(request);
+}
+
+static uint16_t word(const ModbusMessage &response, uint16_t i)
+{
+    uint16_t v = 0;
+    response.get(3 + 2 * i, v);
+    return v;
+}
+
+// Each slave answers with its own ID and register image
+static void addressing()
+{
+    for (uint8_t id = 2; id <= 5; id++)
+    {
+        ModbusMessage response = read(rtu, id, modbus_address, 1);
+        CHECK(response.size() == 5);
+        CHECK(response.getServerID() == id);
+        CHECK(response.getFunctionCode() == READ_HOLD_REGISTER);
+        CHECK(word(response, 0) == id);
+    }
+
+    // A write goes to the addressed slave only
+    ModbusMessage write;
+    write.add(uint8_t(4), uint8_t(WRITE_MULT_REGISTERS), message_delay, uint16_t(1), uint8_t(2), uint16_t(7));
+    CHECK(rtu.request(write).getServerID() == 4);
+    CHECK(word(read(rtu, 4, message_delay, 1), 0) == 7);
+    CHECK(word(read(rtu, 3, message_delay, 1), 0) == 0);
+    CHECK(word(read(rtu, 5, message_delay, 1), 0) == 0);
+}
+
+// Other devices on the bus answer their own requests, so the gateway stays silent
+static void otherIds()
+{
+    CHECK(read(rtu, 1, modbus_address, 1) == NIL_RESPONSE);
+    CHECK(read(rtu, 6, modbus_address, 1) == NIL_RESPONSE);
+    CHECK(read(rtu, 247, modbus_address, 1) == NIL_RESPONSE);
+    CHECK(bus.slave(6) == nullptr);
+    CHECK(bus.slave(3) == &wattnode3);
+    CHECK(bus.allValuesAsString() == "Bus: slaves=2,3,4,5, requests for other IDs=3\r\n");
+
+    // Unsupported function codes of an attached slave are refused
+    ModbusMessage request;
+    request.add(uint8_t(3), uint8_t(READ_INPUT_REGISTER), modbus_address, uint16_t(1));
+    ModbusMessage response = rtu.request(request);
+    CHECK(response.size() == 3);
+    CHECK(response[1] == (READ_INPUT_REGISTER | 0x80));
+    CHECK(response[2] == ILLEGAL_FUNCTION);
+}
+
+// Broadcast, invalid and taken IDs can't be attached
+static void attach()
+{
+    Server<WattNode> &s = wattnode2;
+    CHECK(!bus.attach(0, s));
+    CHECK(!bus.attach(248, s));
+    CHECK(!bus.attach(2, s));
+    CHECK(bus.slave(248) == nullptr);
+}
+
+// The table lookup doesn't depend on the number of slaves
+static void cost()
+{
+    const uint16_t words = WattNode::getDeviceDescription()._bds[1]._number_reg;
+    const uint16_t address = WattNode::getDeviceDescription()._bds[1]._offset;
+    ModbusMessage request;
+    request.add(uint8_t(2), uint8_t(READ_HOLD_REGISTER), address, words);
+    const uint32_t n = 100000;
+    double one = nsPerCall(n, [&](uint32_t)
+                           { keep(single_rtu.request(request).size()); });
+    std::vector<ModbusMessage> requests;
+    for (uint8_t id = 2; id <= 5; id++)
+    {
+        ModbusMessage r;
+        r.add(id, uint8_t(READ_HOLD_REGISTER), address, words);
+        requests.push_back(r);
+    }
+    double four = nsPerCall(n, [&](uint32_t i)
+                            { keep(rtu.request(requests[i % 4]).size()); });
+    printf("FC03 of %u registers through the bus, ns per request\n", words);
+    printf("  1 slave:  %.0f\n", one);
+    printf("  4 slaves: %.0f\n", four);
+}
+
+int main()
+{
+    addressing();
+    otherIds();
+    attach();
+    cost();
+    return report("test_bus");
+}
@@ -0,0 +1,110 @@
+/**
+ * @file      test_conversion_accuracy.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      The compiled conversion plan against the getFloatValue based conversion, on recorded EM24
+ *            register images
+ */
+
+#include "check.h"
+#include "convert_em24_e1_to_wattnode.h"
+#include "em24_samples.h"
+
+using namespace modbus_gateway;
+
+static ModbusServer rtu;
+static Bus bus(rtu);
+static Server<WattNode> wattnode(bus, 2, 1234);
+static Aggregate<EM24_E1> meter{ArrayView<Aggregate<EM24_E1>::Rule>()};
+
+// Floats apart, 0 when equal
+static uint32_t ulps(float a, float b)
+{
+    if (a == b)
+        return 0;
+    if ((a < 0) != (b < 0))
+        return 0xffffffff;
+    int32_t ia, ib;
+    memcpy(&ia, &a, 4);
+    memcpy(&ib, &b, 4);
+    return ia > ib ? ia - ib : ib - ia;
+}
+
+static std::vector<float> wattnodeFloats()
+{
+    std::vector<float> r;
+    for (uint32_t i = 0; i < WattNode::last; i++)
+        r.push_back(wattnodeFloat(wattnode, WattNode::e_registers(i)));
+    return r;
+}
+
+// The raw value of an EM24 register in an image
+static int64_t raw(const Image &image, EM24_E1::e_registers r)
+{
+    for (const Sample &s : image._samples)
+    {
+        if (s._register == r)
+            return s._raw;
+    }
+    return 0;
+}
+
+// A WattNode register copied from one EM24 register is its raw value divided by the EM24 scaling,
+// rounded once
+static void single(const Image &image, const std::vector<float> &plan, WattNode::e_registers w, EM24_E1::e_registers e)
+{
+    double exact = double(raw(image, e)) / getScaling(meter._device._dd.registerDescription(e)._scaling);
+    if (ulps(plan[w], float(exact)) > 1)
+        printf("%s: WattNode %u = %.9g, expected %.9g\n", image._name, w, plan[w], exact);
+    CHECK(ulps(plan[w], float(exact)) <= 1);
+}
+
+int main()
+{
+    ConvertEM24_E1ToWattNode converter(meter, wattnode);
+    uint32_t transaction = 0;
+    uint32_t worst = 0;
+    for (const Image &image : em24Images())
+    {
+        load(meter, image, ++transaction);
+        converter.CopyDataFromMasterToSlave();
+        std::vector<float> plan = wattnodeFloats();
+        handWrittenConversion(meter, wattnode);
+        std::vector<float> hand = wattnodeFloats();
+
+        for (uint32_t r = 0; r < WattNode::last; r++)
+        {
+            if (wattnode._device._dd.registerDescription(WattNode::e_registers(r))._dataType != float32)
+                continue;
+            // Both round a few times, on different paths
+            uint32_t u = ulps(plan[r], hand[r]);
+            worst = std::max(worst, u);
+            if (u > 2)
+                printf("%s: WattNode %u plan=%.9g hand written=%.9g\n", image._name, r, plan[r], hand[r]);
+            CHECK(u <= 2);
+        }
+
+        // The integer path divides with truncation, so negative values have a negative remainder
+        single(image, plan, WattNode::power_factor, EM24_E1::total_pf);
+        single(image, plan, WattNode::l1_power_factor, EM24_E1::l1_power_factor);
+        single(image, plan, WattNode::l2_power_factor, EM24_E1::l2_power_factor);
+        single(image, plan, WattNode::l3_power_factor, EM24_E1::l3_power_factor);
+        single(image, plan, WattNode::power_active, EM24_E1::power_active);
+        single(image, plan, WattNode::l1_power_active, EM24_E1::l1_power_active);
+        single(image, plan, WattNode::l2_power_reactive, EM24_E1::l2_power_reactive);
+        single(image, plan, WattNode::demand_power_active, EM24_E1::demand_power_active);
+        single(image, plan, WattNode::import_energy_active, EM24_E1::import_energy_active);
+        single(image, plan, WattNode::export_energy_active, EM24_E1::export_energy_active);
+    }
+    printf("Plan against hand written conversion: at most %u ulps apart\n", worst);
+
+    // Signs survive the division
+    load(meter, em24Images()[1], ++transaction);
+    converter.CopyDataFromMasterToSlave();
+    CHECK(wattnodeFloat(wattnode, WattNode::l3_power_factor) < 0);
+    CHECK(wattnodeFloat(wattnode, WattNode::power_factor) < 0);
+    CHECK(wattnodeFloat(wattnode, WattNode::power_active) < 0);
+    return report("test_conversion_accuracy");
+}
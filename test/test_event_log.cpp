@@ -0,0 +1,66 @@
+/**
+ * @file      test_event_log.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      The log listing while another thread adds records
+ */
+
+#include <atomic>
+#include <thread>
+#include "check.h"
+#include "event_log.h"
+
+using namespace modbus_gateway;
+
+// The numbers of the listed records, newest first
+static std::vector<int> numbers(const String &listing)
+{
+    std::vector<int> r;
+    for (const char *p = strstr(listing.c_str(), "Register "); p != nullptr; p = strstr(p + 1, "Register "))
+        r.push_back(atoi(p + 9));
+    return r;
+}
+
+int main()
+{
+    Log log(50);
+    CHECK(log.allValuesAsString() == "Log: 0 of 50 records in no memory yet\r\n");
+    log.add(server_write_register, 0, 0);
+    CHECK(log.allValuesAsString().indexOf("Log: 1 of 50 records in internal RAM\r\n") == 0);
+
+    // Every listing is a run of consecutive records, newest first, however the adds interleave
+    for (int i = 1; i < 50; i++)
+        log.add(server_write_register, i, i);
+    std::atomic<bool> stop{false};
+    std::atomic<int> added{50};
+    std::thread writer([&]
+                       {
+        while (!stop)
+        {
+            log.add(server_write_register, added, added);
+            added++;
+        } });
+    uint32_t mixed = 0;
+    uint32_t full = 0;
+    for (int n = 0; n < 2000; n++)
+    {
+        std::vector<int> listed = numbers(log.allValuesAsString());
+        full += listed.size() == 50;
+        for (size_t i = 1; i < listed.size(); i++)
+        {
+            if (listed[i] != listed[i - 1] - 1)
+            {
+                mixed++;
+                break;
+            }
+        }
+    }
+    stop = true;
+    writer.join();
+    CHECK(mixed == 0);
+    CHECK(full == 2000);
+    CHECK(added > 100);
+    return report("test_event_log");
+}
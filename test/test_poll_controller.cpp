@@ -0,0 +1,212 @@
+/**
+ * @file      test_poll_controller.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      The poll periods against a simulated meter on a virtual clock: they settle between the
+ *            minimum period and the maximum staleness, and back off when the meter falls behind or fails
+ *            more than the target
+ */
+
+#include <deque>
+#include "check.h"
+#include "poll_controller.h"
+
+using namespace modbus_gateway;
+
+struct Job
+{
+    const char *_name;
+    uint32_t _period;
+    uint8_t _priority;
+    uint32_t _max_staleness;
+    uint32_t _min_period;
+};
+// As the EM24 blocks
+static const Job blocks[] = {
+    {"dynamic", 300, 0, 1000, 100},
+    {"energy", 2000, 1, 10000, 500},
+    {"time", 10000, 2, 60000, 5000},
+    {"tariff", 10000, 2, 60000, 5000},
+};
+
+// Answers one request at a time in service ms; every fail_every-th request fails when it is not 0.
+// The poll task runs every 10 ms, as the firmware does when nothing is due.
+class Meter
+{
+public:
+    Meter() : _controller(_scheduler)
+    {
+        for (const Job &b : blocks)
+            _scheduler.add(b._name, ReadPlan{ReadRange{0, 10}}, b._period, b._priority, b._max_staleness, 0, b._min_period);
+    }
+
+    void step(uint32_t now, uint32_t service, uint32_t fail_every)
+    {
+        if (!_queue.empty() && now >= _busy_until)
+        {
+            uint32_t issued = _queue.front();
+            _queue.pop_front();
+            _requests++;
+            if (fail_every != 0 && _requests % fail_every == 0)
+                _errors++;
+            else
+                _round_trip = _round_trip == 0 ? now - issued : (_round_trip * 7 + now - issued) / 8;
+            _busy_until = now + service;
+        }
+        if (_queue.empty())
+            _busy_until = std::max(_busy_until, now);
+        if (now % 10 != 0)
+            return;
+        _controller.update(now, _queue.size(), _requests, _errors, _round_trip);
+        _scheduler.run(now, _queue.size(), [&](const ReadPlan &)
+                       { if (_queue.empty() && _busy_until <= now)
+                             _busy_until = now + service;
+                         _queue.push_back(now);
+                         return true; });
+        _max_depth = std::max<uint32_t>(_max_depth, _queue.size());
+    }
+
+    // Every period between its minimum and the maximum staleness
+    bool bounded() const
+    {
+        for (const Job &b : blocks)
+        {
+            uint32_t p = _scheduler.period(b._name);
+            if (p < b._min_period || p > b._max_staleness)
+                return false;
+        }
+        return true;
+    }
+    bool atMinimum() const
+    {
+        for (const Job &b : blocks)
+        {
+            if (_scheduler.period(b._name) != b._min_period)
+                return false;
+        }
+        return true;
+    }
+    uint32_t period(const char *name) const { return _scheduler.period(name); }
+
+    PollScheduler _scheduler{10};
+    PollController _controller;
+    std::deque<uint32_t> _queue;
+    uint32_t _busy_until = 0;
+    uint32_t _requests = 0;
+    uint32_t _errors = 0;
+    uint32_t _round_trip = 0;
+    uint32_t _max_depth = 0;
+};
+
+// Runs the meter from start to end, checking the bounds all the way
+static void run(Meter &m, uint32_t start, uint32_t end, uint32_t service, uint32_t fail_every)
+{
+    bool bounded = true;
+    for (uint32_t now = start; now < end; now++)
+    {
+        m.step(now, service, fail_every);
+        bounded = bounded && m.bounded();
+    }
+    CHECK(bounded);
+}
+
+// A meter that keeps up: every poll rate grows to its maximum
+static void keepsUp()
+{
+    Meter m;
+    run(m, 0, 60000, 20, 0);
+    CHECK(m.atMinimum());
+    CHECK(m._controller.allValuesAsString().indexOf("decreases=0,") >= 0);
+}
+
+// A meter that answers in 400 ms can't keep up with the fastest polls: the periods back off until the
+// queue is short again, and recover when the meter is fast again
+static void slowMeter()
+{
+    Meter m;
+    run(m, 0, 30000, 20, 0);
+    CHECK(m.atMinimum());
+    run(m, 30000, 90000, 400, 0);
+    CHECK(m.period("dynamic") > 2 * 100);
+    CHECK(m.period("energy") > 2 * 500);
+    CHECK(m._max_depth <= 10);
+    // The queue stays near the target on average: over the last 30 s fewer requests than the minimum
+    // periods ask for were sent, and the meter answered all but a few
+    uint32_t requests = m._requests;
+    uint32_t depth = 0;
+    uint32_t samples = 0;
+    for (uint32_t now = 90000; now < 120000; now++)
+    {
+        m.step(now, 400, 0);
+        if (now % 10 == 0)
+        {
+            depth += m._queue.size();
+            samples++;
+        }
+    }
+    CHECK(float(depth) / samples <= 4);
+    CHECK(m._requests - requests <= 30000 / 400 + 1);
+    CHECK(m.bounded());
+
+    run(m, 120000, 180000, 20, 0);
+    CHECK(m.atMinimum());
+}
+
+// A meter that fails 1 request in 10, over the 2% target: the periods back off at every second failure.
+// In the intervals between the rates grow again, so the periods keep moving; on average they are
+// several times their minimum.
+static void errors()
+{
+    Meter m;
+    run(m, 0, 30000, 20, 0);
+    CHECK(m.atMinimum());
+    std::vector<uint64_t> sum(std::size(blocks), 0);
+    uint32_t samples = 0;
+    bool bounded = true;
+    for (uint32_t now = 30000; now < 90000; now++)
+    {
+        m.step(now, 20, 10);
+        bounded = bounded && m.bounded();
+        if (now % 100 != 0)
+            continue;
+        for (size_t b = 0; b < std::size(blocks); b++)
+            sum[b] += m.period(blocks[b]._name);
+        samples++;
+    }
+    CHECK(bounded);
+    for (size_t b = 0; b < std::size(blocks); b++)
+        CHECK(sum[b] / samples >= 3 * blocks[b]._min_period);
+    CHECK(m._controller.allValuesAsString().indexOf("decreases=0,") < 0);
+
+    // Without errors they return to their minimum
+    run(m, 90000, 150000, 20, 0);
+    CHECK(m.atMinimum());
+}
+
+// A meter that fails 1 request in 100, under the 2% target: the periods stay at their minimum
+static void rareErrors()
+{
+    Meter m;
+    run(m, 0, 30000, 20, 0);
+    CHECK(m.atMinimum());
+    bool minimum = true;
+    for (uint32_t now = 30000; now < 150000; now++)
+    {
+        m.step(now, 20, 100);
+        minimum = minimum && m.atMinimum();
+    }
+    CHECK(minimum);
+    CHECK(m._errors > 10);
+    CHECK(m._controller.allValuesAsString().indexOf("decreases=0,") >= 0);
+}
+
+int main()
+{
+    keepsUp();
+    slowMeter();
+    errors();
+    rareErrors();
+    return report("test_poll_controller");
+}
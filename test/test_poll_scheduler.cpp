@@ -0,0 +1,140 @@
+/**
+ * @file      test_poll_scheduler.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      PollScheduler against a virtual clock
+ */
+
+#include "check.h"
+#include "poll_scheduler.h"
+
+using namespace modbus_gateway;
+
+// A plan of one request, the start register tells the jobs apart
+static ReadPlan job(uint16_t id, uint16_t requests = 1)
+{
+    return ReadPlan(requests, ReadRange{id, 2});
+}
+
+// The jobs issued by one run
+static std::vector<uint16_t> run(PollScheduler &s, uint32_t now, uint16_t pending)
+{
+    std::vector<uint16_t> issued;
+    s.run(now, pending, [&](const ReadPlan &p)
+          { issued.push_back(p.front()._start);
+            return true; });
+    return issued;
+}
+
+// Of the due jobs, the one due the longest goes first, also across periods
+static void earliestDeadlineFirst()
+{
+    PollScheduler s(10);
+    s.add("a", job(1), 100, 0, 0, 30);
+    s.add("b", job(2), 300, 0, 0, 10);
+    s.add("c", job(3), 1000, 0, 0, 20);
+    CHECK(run(s, 5, 0).empty());
+    CHECK(s.next(5) == 5);
+    CHECK((run(s, 50, 0) == std::vector<uint16_t>{2, 3, 1}));
+    // a is due at 130 and 230, b at 310
+    CHECK(run(s, 129, 0).empty());
+    CHECK((run(s, 130, 0) == std::vector<uint16_t>{1}));
+    CHECK((run(s, 320, 0) == std::vector<uint16_t>{1, 2}));
+    // A job that fell more than a period behind is due a period from now, not for every missed period
+    CHECK((run(s, 1000, 0) == std::vector<uint16_t>{1, 2}));
+    CHECK(run(s, 1001, 0).empty());
+    CHECK((run(s, 1020, 0) == std::vector<uint16_t>{3}));
+}
+
+// A job of priority p needs its requests plus p * reserve free places in the queue. Without them a
+// job of priority 0 waits and other jobs are shed until their next period.
+static void priorityReserve()
+{
+    PollScheduler s(10, 2);
+    s.add("p0", job(0), 100, 0, 0, 0);
+    s.add("p1", job(1), 100, 1, 0, 0);
+    s.add("p2", job(2), 100, 2, 0, 0);
+    // 4 free: p0 takes 1, p1 needs 1 + 2 of the 3 left, p2 needs 1 + 4 of 2
+    CHECK((run(s, 0, 6) == std::vector<uint16_t>{0, 1}));
+    // p2 was shed, not left due
+    CHECK(run(s, 1, 0).empty());
+    CHECK((run(s, 100, 0) == std::vector<uint16_t>{0, 1, 2}));
+    // A full queue: p0 waits and stays due, the others are shed
+    CHECK(run(s, 200, 10).empty());
+    CHECK(s.next(201) == 0);
+    CHECK((run(s, 201, 9) == std::vector<uint16_t>{0}));
+    CHECK(s.next(202) == 98);
+    // Exactly enough room for a job of priority 2 with two requests
+    PollScheduler t(10, 2);
+    t.add("p2", job(2, 2), 100, 2, 0, 0);
+    CHECK(run(t, 0, 5).empty());
+    CHECK((run(t, 100, 4) == std::vector<uint16_t>{2}));
+}
+
+// A shed job whose values got older than its maximum staleness is treated as priority 0: it can't be
+// shed any more and waits for room instead
+static void staleIsPriorityZero()
+{
+    PollScheduler s(10, 2);
+    s.add("tariff", job(7), 100, 2, 1000, 0);
+    uint32_t first = 0;
+    // 4 free places are too few for priority 2
+    for (uint32_t now = 0; now <= 2000 && first == 0; now += 10)
+    {
+        if (!run(s, now, 6).empty())
+            first = now;
+    }
+    CHECK(first == 1000);
+    // Stale again, and the queue is full: it stays due until there is room
+    CHECK(run(s, 2000, 10).empty());
+    CHECK(s.next(2000) == 0);
+    CHECK(run(s, 2010, 10).empty());
+    CHECK((run(s, 2020, 9) == std::vector<uint16_t>{7}));
+}
+
+// align() shifts the polls of a job so that one is at the given time, keeping the period
+static void align()
+{
+    PollScheduler s(10);
+    s.add("dynamic", job(0), 1000, 0, 0, 0);
+    CHECK(!run(s, 0, 0).empty());
+    s.align("dynamic", 2500, 100);
+    CHECK(run(s, 499, 0).empty());
+    CHECK(!run(s, 500, 0).empty());
+    CHECK(run(s, 1499, 0).empty());
+    CHECK(!run(s, 1500, 0).empty());
+    CHECK(!run(s, 2500, 0).empty());
+    // A time in the past, or later than a pending alignment, is ignored
+    s.align("dynamic", 3700, 2600);
+    s.align("dynamic", 3900, 2600);
+    CHECK(s.next(2600) == 100);
+    s.align("dynamic", 2000, 2600);
+    CHECK(s.next(2600) == 100);
+    // Unknown jobs are ignored
+    s.align("energy", 3000, 2600);
+    CHECK(s.next(2600) == 100);
+}
+
+// Times wrap around after 49 days
+static void wrap()
+{
+    PollScheduler s(10);
+    uint32_t start = 0xffffff00;
+    s.add("dynamic", job(0), 300, 0, 0, start);
+    CHECK(!run(s, start, 0).empty());
+    CHECK(s.next(start) == 300);
+    CHECK(run(s, start + 299, 0).empty());
+    CHECK(!run(s, start + 300, 0).empty());
+}
+
+int main()
+{
+    earliestDeadlineFirst();
+    priorityReserve();
+    staleIsPriorityZero();
+    align();
+    wrap();
+    return report("test_poll_scheduler");
+}
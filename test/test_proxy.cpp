@@ -0,0 +1,137 @@
+/**
+ * @file      test_proxy.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      The proxy against a meter that answers late or not at all, and the reclaim callback of the
+ *            request pool
+ */
+
+#include <WiFiClient.h>
+#include "check.h"
+#include "em24_e1.h"
+#include "proxy.h"
+#include "token_pool.h"
+
+using namespace modbus_gateway;
+
+static WiFiClient connection;
+static ModbusClientTCP tcp(connection, modbus_gateway::Client<EM24_E1>::queue_limit);
+static modbus_gateway::Client<EM24_E1> meter(tcp, IPAddress(), 502, 1);
+
+static ModbusMessage read(uint16_t address, uint16_t words)
+{
+    ModbusMessage request;
+    request.add(uint8_t(5), uint8_t(READ_HOLD_REGISTER), address, words);
+    return request;
+}
+
+static bool isError(const ModbusMessage &response, Error e)
+{
+    return response.size() == 3 && response[1] == (READ_HOLD_REGISTER | 0x80) && response[2] == e;
+}
+
+// A miss the meter never answers times out, and its slot is used again once nobody waits for it. The
+// late answer doesn't end up with the next miss.
+static void abandon()
+{
+    Proxy<EM24_E1, 1> proxy(meter, 100);
+    ModbusMessage a = read(0, 2);
+    ModbusMessage b = read(10, 2);
+    ModbusMessage response;
+    uint32_t ta = 0;
+    CHECK(!proxy.serve(a, response, ta, 0));
+    CHECK(ta != 0);
+    CHECK(tcp._queue.size() == 1);
+
+    // The only slot waits for the meter
+    uint32_t tb = 0;
+    CHECK(proxy.serve(b, response, tb, 50));
+    CHECK(isError(response, SERVER_DEVICE_BUSY));
+    CHECK(tb == 0);
+
+    response = ModbusMessage();
+    CHECK(!proxy.serve(a, response, ta, 99));
+    CHECK(proxy.serve(a, response, ta, 100));
+    CHECK(isError(response, GATEWAY_TARGET_NO_RESP));
+
+    // Timed out and nobody waits: abandoned
+    response = ModbusMessage();
+    CHECK(!proxy.serve(b, response, tb, 100));
+    CHECK(tb != 0);
+    CHECK(tcp._queue.size() == 2);
+    tcp.respond([](uint16_t)
+                { return 0x1111; });
+    CHECK(!proxy.serve(b, response, tb, 110));
+    tcp.respond([](uint16_t)
+                { return 0x2222; });
+    CHECK(proxy.serve(b, response, tb, 120));
+    CHECK((response == ModbusMessage(std::vector<uint8_t>{5, READ_HOLD_REGISTER, 4, 0x22, 0x22, 0x22, 0x22})));
+    CHECK(proxy.allValuesAsString().indexOf("timeouts=1, abandoned=1") >= 0);
+}
+
+// A timed out miss that someone still waits for is not abandoned
+static void waiters()
+{
+    Proxy<EM24_E1, 1> proxy(meter, 100);
+    ModbusMessage a = read(20, 2);
+    ModbusMessage response;
+    uint32_t ta = 0;
+    CHECK(!proxy.serve(a, response, ta, 0));
+    uint32_t tc = 0;
+    CHECK(proxy.serve(read(30, 2), response, tc, 150));
+    CHECK(isError(response, SERVER_DEVICE_BUSY));
+
+    // An exception from the meter is passed on, and frees the slot
+    tcp.fail(ILLEGAL_DATA_ADDRESS);
+    response = ModbusMessage();
+    CHECK(proxy.serve(a, response, ta, 160));
+    CHECK(isError(response, ILLEGAL_DATA_ADDRESS));
+    response = ModbusMessage();
+    CHECK(!proxy.serve(read(30, 2), response, tc, 160));
+    tcp.drop();
+    CHECK(tcp._queue.empty());
+}
+
+// The owner hears about reclaimed contexts, and their tokens are stale
+static void reclaim()
+{
+    TokenPool<int, 2> pool;
+    uint32_t t1 = pool.acquire(1, 0, 100);
+    uint32_t t2 = pool.acquire(2, 10, 100);
+    int value = 0;
+    uint32_t token = 0;
+    auto reclaimed = [&](const int &v, uint32_t t)
+    {
+        value = v;
+        token = t;
+    };
+    CHECK(pool.acquire(3, 99, 100, reclaimed) == 0);
+    CHECK(token == 0);
+    uint32_t t3 = pool.acquire(3, 100, 100, reclaimed);
+    CHECK(t3 != 0);
+    CHECK(value == 1);
+    CHECK(token == t1);
+    int released = 0;
+    CHECK(!pool.release(t1, released));
+    CHECK(pool.release(t2, released) && released == 2);
+    CHECK(pool.release(t3, released) && released == 3);
+
+    // A forwarded request is claimed by one of the pool, the eModbus task and the proxy
+    Forwarded f;
+    f._token = t3;
+    CHECK(!f.claim(t1));
+    CHECK(!f.claim(0));
+    CHECK(f.claim(t3));
+    CHECK(!f.claim(t3));
+}
+
+int main()
+{
+    meter.connect();
+    abandon();
+    waiters();
+    reclaim();
+    return report("test_proxy");
+}
@@ -0,0 +1,134 @@
+/**
+ * @file      test_tasks.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      The std::thread implementation of Task: start, notify, timeout, pinning and stop
+ */
+
+#include <chrono>
+#include <thread>
+#include "check.h"
+#include "tasks.h"
+
+using namespace modbus_gateway;
+
+// Waits up to a second for done()
+template <typename F>
+static bool eventually(F done)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        if (done())
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+// A task that sleeps forever runs once when started and once per notify()
+static void notify()
+{
+    std::atomic<uint32_t> runs{0};
+    Task task("notified", 4096, 1, -1, [&]
+              { runs++;
+                return Task::forever; });
+    task.start();
+    CHECK(eventually([&]
+                     { return runs == 1; }));
+    for (uint32_t i = 2; i <= 4; i++)
+    {
+        task.notify();
+        CHECK(eventually([&]
+                         { return runs == i; }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    CHECK(runs == 4);
+    task.stop();
+}
+
+// The work function returns how long to sleep
+static void timeout()
+{
+    std::atomic<uint32_t> runs{0};
+    Task task("periodic", 4096, 1, -1, [&]
+              { runs++;
+                return 5u; });
+    task.start();
+    CHECK(eventually([&]
+                     { return runs >= 10; }));
+    task.stop();
+}
+
+// Pinned to a core the host has, the work runs on that core; other cores are ignored
+static void pin()
+{
+    std::atomic<int> cpu{-1};
+    Task pinned("pinned", 4096, 1, 0, [&]
+                { cpu = sched_getcpu();
+                  return Task::forever; });
+    pinned.start();
+    CHECK(eventually([&]
+                     { return cpu != -1; }));
+    CHECK(cpu == 0);
+    pinned.stop();
+
+    std::atomic<uint32_t> runs{0};
+    Task unknown("unknown core", 4096, 1, 1000, [&]
+                 { runs++;
+                   return Task::forever; });
+    unknown.start();
+    CHECK(eventually([&]
+                     { return runs == 1; }));
+}
+
+// stop() waits for the work function to return and ends the task, which can be started again
+static void stop()
+{
+    std::atomic<uint32_t> runs{0};
+    std::atomic<bool> busy{false};
+    Task task("stopped", 4096, 1, -1, [&]
+              { busy = true;
+                std::this_thread::sleep_for(std::chrono::milliseconds(20));
+                runs++;
+                busy = false;
+                return 1u; });
+    task.start();
+    task.start();
+    CHECK(eventually([&]
+                     { return busy.load(); }));
+    task.stop();
+    CHECK(!busy);
+    uint32_t stopped = runs;
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK(runs == stopped);
+    task.stop();
+    task.notify();
+
+    task.start();
+    CHECK(eventually([&]
+                     { return runs > stopped; }));
+    // The destructor stops it
+}
+
+// Tasks are listed while they exist
+static void list()
+{
+    {
+        Task task("listed", 4096, 1, -1, []
+                  { return Task::forever; });
+        CHECK(Task::allValuesAsString().indexOf("Task listed:") >= 0);
+    }
+    CHECK(Task::allValuesAsString().indexOf("Task listed:") < 0);
+}
+
+int main()
+{
+    notify();
+    timeout();
+    pin();
+    stop();
+    list();
+    return report("test_tasks");
+}
@@ -0,0 +1,58 @@
+/**
+ * @file      test_typed_get.cpp
+ * @author    Guido Jansen (guido@ngjansen.be)
+ * @license   MIT
+ * @copyright Copyright (c) 2025 Guido Jansen
+ * @date      17-Oct-2026
+ * @note      The compile time accessor get<R>() against the decoded values, for every register of the
+ *            EM24 and the WattNode on the recorded EM24 register images
+ */
+
+#include <utility>
+#include "check.h"
+#include "convert_em24_e1_to_wattnode.h"
+#include "em24_samples.h"
+
+using namespace modbus_gateway;
+
+static ModbusServer rtu;
+static Bus bus(rtu);
+static Server<WattNode> wattnode(bus, 2, 1234);
+static Aggregate<EM24_E1> meter{ArrayView<Aggregate<EM24_E1>::Rule>()};
+
+// Registers where get<R>() and getValue(R) are not the same to the last bit
+template <typename MODBUS_TYPE, typename T, size_t... I>
+static uint32_t mismatches(const DataAccess<T> &dataaccess, std::index_sequence<I...>)
+{
+    uint32_t n = 0;
+    auto compare = [&](float a, float b, size_t r)
+    {
+        if (memcmp(&a, &b, sizeof(float)) != 0)
+        {
+            printf("register %zu: get %.9g, getValue %.9g\n", r, a, b);
+            n++;
+        }
+    };
+    (compare(dataaccess.template get<typename MODBUS_TYPE::e_registers(I)>(), dataaccess.getValue(typename MODBUS_TYPE::e_registers(I)), I), ...);
+    return n;
+}
+
+int main()
+{
+    ConvertEM24_E1ToWattNode converter(meter, wattnode);
+    uint32_t transaction = 0;
+    for (const Image &image : em24Images())
+    {
+        load(meter, image, ++transaction);
+        converter.CopyDataFromMasterToSlave();
+        {
+            DataAccess<Aggregate<EM24_E1>> m(meter);
+            CHECK(mismatches<EM24_E1>(m, std::make_index_sequence<EM24_E1::last>()) == 0);
+        }
+        {
+            DataAccess<Server<WattNode>> w(wattnode);
+            CHECK(mismatches<WattNode>(w, std::make_index_sequence<WattNode::last>()) == 0);
+        }
+    }
+    return report("test_typed_get");
+}